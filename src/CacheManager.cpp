@@ -1,29 +1,98 @@
 #include "CacheManager.h"
-CacheManager::CacheManager(size_t maxSize, size_t cursize) : maxCacheSize(maxSize), currentSize(cursize) {}
+#include "Hash.h"
+#include "Gzip.h"
+#include "HttpParser.h"
+#include <cstring>
+#include <strings.h>
+#include <fstream>
+#include <vector>
+#include <unordered_set>
+#include <thread>
+#include <algorithm>
+#include <cstdio>
+#include <functional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Bodies smaller than this gain too little from gzip to be worth inflating on a hit
+#define MIN_COMPRESS_SIZE 256
+
+namespace {
+bool isCompressibleType(const std::string& contentType) {
+    static const char* types[] = {
+        "text/", "application/javascript", "application/x-javascript", "application/json",
+        "application/xml", "image/svg+xml"
+    };
+    for (const char* type : types) {
+        if (strncasecmp(contentType.c_str(), type, strlen(type)) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Only plain Content-Length bodies are compressed, anything already encoded or chunked is stored as-is
+bool shouldCompress(const std::string& headers, const std::string& body) {
+    return body.size() >= MIN_COMPRESS_SIZE &&
+           HttpParser::findHeader(headers, "Content-Encoding").empty() &&
+           HttpParser::findHeader(headers, "Transfer-Encoding").empty() &&
+           !HttpParser::findHeader(headers, "Content-Length").empty() &&
+           isCompressibleType(HttpParser::findHeader(headers, "Content-Type"));
+}
+
+// Rewrite the header block for sending the compressed body unchanged
+std::string buildGzipHeaders(const std::string& headers, size_t compressedSize) {
+    std::string vary = HttpParser::findHeader(headers, "Vary");
+    std::string result;
+    size_t lineStart = 0;
+    size_t lineEnd;
+    while ((lineEnd = headers.find("\r\n", lineStart)) != std::string::npos && lineEnd != lineStart) {
+        std::string line = headers.substr(lineStart, lineEnd - lineStart);
+        if (strncasecmp(line.c_str(), "Content-Length:", 15) != 0 &&
+            strncasecmp(line.c_str(), "Vary:", 5) != 0) {
+            result += line + "\r\n";
+        }
+        lineStart = lineEnd + 2;
+    }
+    result += "Content-Encoding: gzip\r\n";
+    result += "Content-Length: " + std::to_string(compressedSize) + "\r\n";
+    result += "Vary: " + (vary.empty() ? std::string("Accept-Encoding") : vary + ", Accept-Encoding") + "\r\n";
+    result += "\r\n";
+    return result;
+}
+}
+
+CacheManager::CacheManager(size_t maxSize, size_t cursize, bool compressText)
+    : maxCacheSize(maxSize), currentSize(cursize), dedupedBytes(0), compressText(compressText) {}
 
 bool CacheManager::isExpired(const CacheEntry& entry) const {
     return entry.expiry < time(nullptr);
 }
-void CacheManager::evictLRU() {
-    std::lock_guard<std::mutex> lock(cacheMutex);
-    time_t oldestTimestamp = time(nullptr);
-    std::string oldestUrl;
-    for (const auto& entry : cache) {
-        if (entry.second.timestamp < oldestTimestamp) {
-            oldestTimestamp = entry.second.timestamp;
-            oldestUrl = entry.first;
+// Remove the least recently stored entry. Returns false when the cache is empty. Caller must hold cacheMutex
+bool CacheManager::evictLRU() {
+    auto oldest = cache.end();
+    for (auto it = cache.begin(); it != cache.end(); ++it) {
+        if (oldest == cache.end() || it->second.timestamp < oldest->second.timestamp) {
+            oldest = it;
         }
     }
-    remove(oldestUrl);
+    if (oldest == cache.end()) {
+        return false;
+    }
+    std::string url = oldest->first;
+    removeLocked(url);
+    return true;
 }
 std::shared_ptr<CacheEntry> CacheManager::get(const std::string& url) {
     std::lock_guard<std::mutex> lock(cacheMutex);
-    
+
     auto it = cache.find(url);
     if (it != cache.end()) {
         if (isExpired(it->second)) { // check if the entry is expired
             std::cout << url << ": in cache, but expired at" << it->second.expiry << std::endl;
-            return nullptr; // Important: do i need to remove the entry? 
+            return nullptr; // Important: do i need to remove the entry?
         }
         else if (it->second.requiresValidation) { // check if the entry requires validation
             std::cout << url << ": in cache, requires validation" << std::endl;
@@ -31,46 +100,467 @@ std::shared_ptr<CacheEntry> CacheManager::get(const std::string& url) {
         }
         else { // valid entry
             std::cout << url << ": in cache, valid" << std::endl;
-            return std::make_shared<CacheEntry>(it->second); //
+            return std::make_shared<CacheEntry>(it->second); // body is shared, only the headers are copied
         }
     }
     std::cout << url << ": not in cache" << std::endl; // not in cache
     return nullptr;
-    
+
+}
+
+/**
+ * @brief: Look the body up in the content-addressed store, adding it if it is new.
+ *         Identical bodies under different URLs end up sharing one buffer.
+ *         Caller must hold cacheMutex.
+ */
+std::shared_ptr<const std::string> CacheManager::acquireBody(const std::string& body, uint64_t hash) {
+    auto it = bodies.find(hash);
+    if (it != bodies.end()) {
+        // Compare the bytes too, a hash collision must never serve the wrong body
+        if (*it->second.data == body) {
+            ++it->second.refs;
+            dedupedBytes += body.size();
+            return it->second.data;
+        }
+        // Collision: keep this body private to its entry
+        currentSize += body.size();
+        return std::make_shared<const std::string>(body);
+    }
+    StoredBody stored;
+    stored.data = std::make_shared<const std::string>(body);
+    stored.refs = 1;
+    bodies[hash] = stored;
+    currentSize += body.size();
+    return stored.data;
+}
+
+// Drop one reference to the entry's body, freeing it with the last one. Caller must hold cacheMutex.
+void CacheManager::releaseBody(const CacheEntry& entry) {
+    if (!entry.body) {
+        return;
+    }
+    auto it = bodies.find(entry.bodyHash);
+    if (it == bodies.end() || it->second.data != entry.body) {
+        // Private body left by a hash collision
+        currentSize -= entry.body->size();
+        return;
+    }
+    if (--it->second.refs == 0) {
+        currentSize -= entry.body->size();
+        bodies.erase(it);
+    } else {
+        dedupedBytes -= entry.body->size();
+    }
+}
+
+// Insert a prepared entry with its body bytes, evicting as needed. Caller must hold cacheMutex.
+void CacheManager::storeLocked(const std::string& key, CacheEntry& entry, const std::string& body) {
+    size_t needed = entry.headers.size() + entry.gzipHeaders.size() + body.size();
+    if (needed >= maxCacheSize) {
+        return;
+    }
+    // Replacing an entry must release its old body first
+    removeLocked(key);
+    while (currentSize + needed >= maxCacheSize) {
+        if (!evictLRU()) {
+            break;
+        }
+    }
+    entry.bodyHash = hash64(body);
+    entry.body = acquireBody(body, entry.bodyHash);
+    currentSize += entry.headers.size() + entry.gzipHeaders.size();
+    cache[key] = entry;
 }
 
-void CacheManager::put(const std::string& url, const std::string& response, 
+void CacheManager::put(const std::string& url, const std::string& response,
              const std::chrono::seconds& maxAge, bool requiresValidation) {
     std::lock_guard<std::mutex> lock(cacheMutex);
-    if (currentSize + response.size()>= maxCacheSize) {
-        evictLRU();
+    if (response.size() >= maxCacheSize) {
+        return;
     }
+
+    // Split the header block from the body so the body can be content-addressed
+    size_t headerEnd = response.find("\r\n\r\n");
+    size_t bodyStart = headerEnd == std::string::npos ? response.size() : headerEnd + 4;
+
     CacheEntry entry;
-    entry.response = response;
+    entry.headers = response.substr(0, bodyStart);
+    std::string body = response.substr(bodyStart);
+    entry.gzipped = false;
+    if (compressText && shouldCompress(entry.headers, body)) {
+        std::string compressed;
+        if (gzipCompress(body, compressed) && compressed.size() < body.size()) {
+            entry.gzipHeaders = buildGzipHeaders(entry.headers, compressed.size());
+            body.swap(compressed);
+            entry.gzipped = true;
+        }
+    }
+    entry.objectLength = 0;
     entry.timestamp = time(nullptr);
     entry.expiry = entry.timestamp + maxAge.count();
     entry.requiresValidation = requiresValidation;
 
-    cache[url] = entry;
-    currentSize += response.size();
-    std::cout << url << ": added to cache" << std::endl;    
-    
+    storeLocked(url, entry, body);
+}
+
+std::string CacheManager::segmentKey(const std::string& url, size_t index) {
+    return url + " #segment " + std::to_string(index);
+}
+
+/**
+ * @brief: Cached segment of a large object, or nullptr if it is missing or expired
+ */
+std::shared_ptr<CacheEntry> CacheManager::getSegment(const std::string& url, size_t index) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto it = cache.find(segmentKey(url, index));
+    if (it == cache.end() || isExpired(it->second)) {
+        return nullptr;
+    }
+    return std::make_shared<CacheEntry>(it->second);
+}
+
+/**
+ * @brief: Store one SEGMENT_SIZE piece of a large object. headers holds the origin's
+ *         headers without Content-Length/Content-Range, objectLength the full size.
+ */
+void CacheManager::putSegment(const std::string& url, size_t index, const std::string& headers,
+                              const std::string& data, size_t objectLength, const std::chrono::seconds& maxAge) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    CacheEntry entry;
+    entry.headers = headers;
+    entry.gzipped = false;
+    entry.objectLength = objectLength;
+    entry.timestamp = time(nullptr);
+    entry.expiry = entry.timestamp + maxAge.count();
+    entry.requiresValidation = false;
+    storeLocked(segmentKey(url, index), entry, data);
+}
+
+// Drop every cached segment of an object of objectLength bytes
+void CacheManager::removeSegments(const std::string& url, size_t objectLength) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    for (size_t index = 0; index * SEGMENT_SIZE < objectLength; ++index) {
+        removeLocked(segmentKey(url, index));
+    }
 }
 
 void CacheManager::clear() {
     std::lock_guard<std::mutex> lock(cacheMutex);
     cache.clear();
+    bodies.clear();
+    currentSize = 0;
+    dedupedBytes = 0;
 }
 void CacheManager::remove(const std::string& url) {
-        std::lock_guard<std::mutex> lock(cacheMutex); // 加锁
-        auto it = cache.find(url);
-        if (it != cache.end()) {
-            currentSize -= it->second.response.size();
-            cache.erase(it);
-            std::cout << url << ": removed from cache" << std::endl;
-        }
+    std::lock_guard<std::mutex> lock(cacheMutex); // 加锁
+    removeLocked(url);
+}
+
+// Caller must hold cacheMutex
+void CacheManager::removeLocked(const std::string& url) {
+    auto it = cache.find(url);
+    if (it != cache.end()) {
+        currentSize -= it->second.headers.size() + it->second.gzipHeaders.size();
+        releaseBody(it->second);
+        cache.erase(it);
     }
+}
 
 size_t CacheManager::size() const {
     return cache.size();
-} 
\ No newline at end of file
+}
+
+size_t CacheManager::bytesUsed() const {
+    return currentSize;
+}
+
+// Bytes saved by sharing bodies instead of storing one copy per URL
+size_t CacheManager::bytesDeduplicated() const {
+    return dedupedBytes;
+}
+
+
+namespace {
+const char SNAPSHOT_MAGIC[8] = {'W', 'P', 'S', 'N', 'A', 'P', '0', '1'};
+
+template <typename T>
+void writeValue(std::ofstream& out, T value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void writeString(std::ofstream& out, const std::string& value) {
+    writeValue<uint64_t>(out, value.size());
+    out.write(value.data(), value.size());
+}
+
+// Bounds-checked cursor over a snapshot file mapped into memory
+struct SnapshotReader {
+    const char* data;
+    size_t size;
+    size_t pos;
+
+    template <typename T>
+    bool read(T& value) {
+        if (size - pos < sizeof(T)) {
+            return false;
+        }
+        memcpy(&value, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+
+    // Step over a length-prefixed string, leaving where it starts and how long it is
+    bool skipString(size_t& offset, size_t& length) {
+        uint64_t stored;
+        if (!read(stored) || size - pos < stored) {
+            return false;
+        }
+        offset = pos;
+        length = stored;
+        pos += stored;
+        return true;
+    }
+
+    bool readString(std::string& value) {
+        size_t offset, length;
+        if (!skipString(offset, length)) {
+            return false;
+        }
+        value.assign(data + offset, length);
+        return true;
+    }
+};
+
+// Fixed-size fields that follow the three strings of an index entry
+const size_t SNAPSHOT_ENTRY_FIELDS = 1 + 8 + 1 + 1 + 8 + 8 + 8;
+}
+
+/**
+ * @brief: Write the cache index and every body once (bodies are shared between entries)
+ *         to path. The file is written next to path and renamed, so a crash mid-write
+ *         never leaves a torn snapshot behind.
+ */
+bool CacheManager::saveSnapshot(const std::string& path) {
+    std::vector<std::pair<std::string, CacheEntry>> entries;
+    std::vector<std::pair<uint64_t, std::shared_ptr<const std::string>>> storedBodies;
+    {
+        // Only copy the index under the lock, bodies are immutable and refcounted
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        entries.assign(cache.begin(), cache.end());
+        for (const auto& body : bodies) {
+            storedBodies.emplace_back(body.first, body.second.data);
+        }
+    }
+
+    std::string tmpPath = path + ".tmp";
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        return false;
+    }
+    out.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    writeValue<uint64_t>(out, storedBodies.size());
+    for (const auto& body : storedBodies) {
+        writeValue<uint64_t>(out, body.first);
+        writeString(out, *body.second);
+    }
+
+    time_t now = time(nullptr);
+    std::unordered_set<const std::string*> written;
+    for (const auto& body : storedBodies) {
+        written.insert(body.second.get());
+    }
+    std::vector<const std::pair<std::string, CacheEntry>*> live;
+    for (const auto& entry : entries) {
+        const CacheEntry& e = entry.second;
+        // Expired entries and bodies kept private after a hash collision are not worth restoring
+        if (e.expiry >= now && (!e.body || written.count(e.body.get()) > 0)) {
+            live.push_back(&entry);
+        }
+    }
+    writeValue<uint64_t>(out, live.size());
+    for (const auto* entry : live) {
+        const CacheEntry& e = entry->second;
+        writeString(out, entry->first);
+        writeString(out, e.headers);
+        writeString(out, e.gzipHeaders);
+        writeValue<uint8_t>(out, e.body ? 1 : 0);
+        writeValue<uint64_t>(out, e.bodyHash);
+        writeValue<uint8_t>(out, e.gzipped ? 1 : 0);
+        writeValue<uint8_t>(out, e.requiresValidation ? 1 : 0);
+        writeValue<int64_t>(out, e.timestamp);
+        writeValue<int64_t>(out, e.expiry);
+        writeValue<uint64_t>(out, e.objectLength);
+    }
+    out.close();
+    if (!out) {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief: Restore a snapshot written by saveSnapshot. The file is mapped, one pass finds
+ *         where each body and index entry starts, reading only the length fields, and
+ *         worker threads then parse the entries and copy out and hash-check the bodies
+ *         in parallel. The index is inserted under a single lock. Entries that expired
+ *         meanwhile or whose body does not match its hash are skipped.
+ */
+bool CacheManager::loadSnapshot(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(SNAPSHOT_MAGIC)) {
+        close(fd);
+        return false;
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    std::unique_ptr<void, std::function<void(void*)>> unmap(mapped, [size](void* p) { munmap(p, size); });
+    const char* data = static_cast<const char*>(mapped);
+    if (memcmp(data, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        return false;
+    }
+    SnapshotReader reader{data, size, sizeof(SNAPSHOT_MAGIC)};
+
+    // Pass 1: record boundaries, without touching the bytes of bodies or strings
+    struct BodyRef {
+        uint64_t hash;
+        size_t offset;
+        size_t length;
+    };
+    uint64_t bodyCount;
+    if (!reader.read(bodyCount)) {
+        return false;
+    }
+    std::vector<BodyRef> refs;
+    for (uint64_t i = 0; i < bodyCount; ++i) {
+        BodyRef ref;
+        if (!reader.read(ref.hash) || !reader.skipString(ref.offset, ref.length)) {
+            return false;
+        }
+        refs.push_back(ref);
+    }
+    uint64_t entryCount;
+    if (!reader.read(entryCount)) {
+        return false;
+    }
+    std::vector<size_t> entryOffsets;
+    for (uint64_t i = 0; i < entryCount; ++i) {
+        entryOffsets.push_back(reader.pos);
+        size_t offset, length;
+        for (int field = 0; field < 3; ++field) {
+            if (!reader.skipString(offset, length)) {
+                return false;
+            }
+        }
+        if (size - reader.pos < SNAPSHOT_ENTRY_FIELDS) {
+            return false;
+        }
+        reader.pos += SNAPSHOT_ENTRY_FIELDS;
+    }
+
+    // Pass 2: bodies and entries are parsed and checked by several threads
+    std::vector<std::shared_ptr<const std::string>> loaded(refs.size());
+    std::vector<std::pair<std::string, CacheEntry>> entries(entryOffsets.size());
+    std::vector<uint8_t> hasBody(entryOffsets.size(), 0);
+    size_t work = refs.size() + entryOffsets.size();
+    size_t workers = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), work / 64 + 1));
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < workers; ++w) {
+        threads.emplace_back([&, w]() {
+            for (size_t i = w; i < refs.size(); i += workers) {
+                // A body that does not hash to its key is damaged, its entries are dropped
+                if (hash64(data + refs[i].offset, refs[i].length) == refs[i].hash) {
+                    loaded[i] = std::make_shared<const std::string>(data + refs[i].offset, refs[i].length);
+                }
+            }
+            for (size_t i = w; i < entryOffsets.size(); i += workers) {
+                SnapshotReader entryReader{data, size, entryOffsets[i]};
+                CacheEntry& entry = entries[i].second;
+                uint8_t gzipped, requiresValidation;
+                int64_t timestamp, expiry;
+                uint64_t objectLength;
+                // Pass 1 checked the bounds, these reads cannot fail
+                entryReader.readString(entries[i].first);
+                entryReader.readString(entry.headers);
+                entryReader.readString(entry.gzipHeaders);
+                entryReader.read(hasBody[i]);
+                entryReader.read(entry.bodyHash);
+                entryReader.read(gzipped);
+                entryReader.read(requiresValidation);
+                entryReader.read(timestamp);
+                entryReader.read(expiry);
+                entryReader.read(objectLength);
+                entry.gzipped = gzipped != 0;
+                entry.requiresValidation = requiresValidation != 0;
+                entry.timestamp = static_cast<time_t>(timestamp);
+                entry.expiry = static_cast<time_t>(expiry);
+                entry.objectLength = objectLength;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    std::unordered_map<uint64_t, std::shared_ptr<const std::string>> byHash;
+    for (size_t i = 0; i < refs.size(); ++i) {
+        if (loaded[i]) {
+            byHash[refs[i].hash] = loaded[i];
+        }
+    }
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (hasBody[i]) {
+            auto it = byHash.find(entries[i].second.bodyHash);
+            if (it == byHash.end()) {
+                entries[i].first.clear();   // body missing or damaged
+                continue;
+            }
+            entries[i].second.body = it->second;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    time_t now = time(nullptr);
+    for (auto& item : entries) {
+        CacheEntry& entry = item.second;
+        if (item.first.empty() || isExpired(entry) || cache.count(item.first) > 0) {
+            continue;
+        }
+        // A snapshot from another host or before a clock step must not date entries in the future
+        entry.timestamp = std::min(entry.timestamp, now);
+        bool newBody = entry.body && bodies.count(entry.bodyHash) == 0;
+        size_t needed = entry.headers.size() + entry.gzipHeaders.size() + (newBody ? entry.body->size() : 0);
+        if (currentSize + needed >= maxCacheSize) {
+            continue;
+        }
+        if (entry.body) {
+            auto it = bodies.find(entry.bodyHash);
+            if (it == bodies.end()) {
+                StoredBody stored;
+                stored.data = entry.body;
+                stored.refs = 1;
+                bodies[entry.bodyHash] = stored;
+            } else if (*it->second.data != *entry.body) {
+                continue;  // hash collision with a body already in the cache
+            } else {
+                ++it->second.refs;
+                entry.body = it->second.data;
+                dedupedBytes += entry.body->size();
+            }
+        }
+        currentSize += needed;
+        cache[item.first] = entry;
+    }
+    return true;
+}
@@ -5,31 +5,66 @@
 #include <mutex>
 #include <chrono>
 #include <memory>
+#include <cstdint>
+
+// Large objects requested by byte range are cached in pieces of this size
+#define SEGMENT_SIZE (1024 * 1024)
 
 struct CacheEntry {
-    std::string response;
+    std::string headers;                      // status line and header block, including the blank line
+    std::shared_ptr<const std::string> body;  // shared by every entry with identical body bytes
+    std::string gzipHeaders;                  // header block to send with the body as-is when gzipped
+    uint64_t bodyHash;
+    bool gzipped;                             // body is stored gzip-compressed
     time_t timestamp;
     time_t expiry;
     bool requiresValidation;
+    size_t objectLength;                      // full object size for segments, 0 for whole responses
+
+    // Full response as stored, gzipped bodies come with their gzip header block
+    std::string response() const { return (gzipped ? gzipHeaders : headers) + (body ? *body : ""); }
 };
 
 class CacheManager {
 private:
+    // One body in the content-addressed store, refcounted by the URL entries using it
+    struct StoredBody {
+        std::shared_ptr<const std::string> data;
+        size_t refs;
+    };
+
     std::unordered_map<std::string, CacheEntry> cache;
+    std::unordered_map<uint64_t, StoredBody> bodies;
     std::mutex cacheMutex;
     size_t maxCacheSize;
     size_t currentSize;
+    size_t dedupedBytes;
+    bool compressText;
     bool isExpired(const CacheEntry& entry) const; // check if the entry is expired
-    void evictLRU(); // evict the least recently used entry
+    bool evictLRU(); // evict the least recently used entry
+    void removeLocked(const std::string& url);
+    std::shared_ptr<const std::string> acquireBody(const std::string& body, uint64_t hash);
+    void releaseBody(const CacheEntry& entry);
+    void storeLocked(const std::string& key, CacheEntry& entry, const std::string& body);
+    static std::string segmentKey(const std::string& url, size_t index);
 
 public:
-    CacheManager(size_t maxSize = 1024, size_t cursize = 0);
+    CacheManager(size_t maxSize = 1024, size_t cursize = 0, bool compressText = false);
     std::shared_ptr<CacheEntry> get(const std::string& url);
-    void put(const std::string& url, const std::string& response, 
+    void put(const std::string& url, const std::string& response,
              const std::chrono::seconds& maxAge, bool requiresValidation);
+    std::shared_ptr<CacheEntry> getSegment(const std::string& url, size_t index);
+    void putSegment(const std::string& url, size_t index, const std::string& headers,
+                    const std::string& data, size_t objectLength, const std::chrono::seconds& maxAge);
+    void removeSegments(const std::string& url, size_t objectLength);
     void remove(const std::string& url);
     void clear();
-    
+
 
     size_t size() const;
-}; 
\ No newline at end of file
+    size_t bytesUsed() const;
+    size_t bytesDeduplicated() const;
+
+    bool saveSnapshot(const std::string& path);
+    bool loadSnapshot(const std::string& path);
+};
@@ -6,9 +6,17 @@
 #include <iostream>
 #include <arpa/inet.h>
 
+// Longest request line and header section we are willing to buffer
+#define MAX_REQUEST_HEAD (64 * 1024)
 
-ConnectionHandler::ConnectionHandler(std::shared_ptr<RequestHandler> handler, std::shared_ptr<Logger> logger)
-    : requestHandler(handler), logger(logger), serverSocket(-1), id(0) {}
+
+ConnectionHandler::ConnectionHandler(std::shared_ptr<RequestHandler> handler, std::shared_ptr<Logger> logger,
+                                     std::shared_ptr<TimerService> timers)
+    : requestHandler(handler), logger(logger), timers(timers), serverSocket(-1), id(0) {
+    if (!this->timers) {
+        this->timers = std::make_shared<TimerService>();
+    }
+}
 
 ConnectionHandler::~ConnectionHandler() {
     stop();
@@ -24,6 +32,10 @@ void ConnectionHandler::start(int port) {
         throw std::runtime_error("Failed to create socket");
     }
 
+    // Allow rebinding right after a restart while old connections sit in TIME_WAIT
+    int reuse = 1;
+    setsockopt(serverSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     struct sockaddr_in serverAddr;
     serverAddr.sin_family = AF_INET;
     serverAddr.sin_addr.s_addr = INADDR_ANY;
@@ -57,8 +69,7 @@ void ConnectionHandler::start(int port) {
         ++this->id;
         
         // Store the new request
-        std::string ip = std::string(clientIP);
-        logger->log("from " + ip, id);
+        logger->event(EVENT_CONNECTION, id, clientIP);
         // Create a new thread and execute handleClient func
         clientThreads.emplace_back(&ConnectionHandler::handleClient, this, clientSocket, id);
     } 
@@ -69,15 +80,37 @@ void ConnectionHandler::start(int port) {
 void ConnectionHandler::handleClient(int clientSocket, int clientId){
     const int BUFFER_SIZE = 4096;
     char buffer[BUFFER_SIZE];
-    // Read the data
-    ssize_t bytesRead = recv(clientSocket, buffer, BUFFER_SIZE - 1, 0);
-    if (bytesRead > 0) {
-        // Add the end symbol
-        buffer[bytesRead] = '\0';
-        // Convert the C style string to the C++ style
-        std::string request(buffer);
-        // Get the response 
-        requestHandler->handleRequest(request, clientSocket, clientId);
+    // Bytes read from the client that no request has consumed yet. Pipelined requests wait
+    // here and are handled one after the other, so their responses go out in order
+    std::string pending;
+    bool keepAlive = true;
+    int handled = 0;
+    while (keepAlive) {
+        // Read up to the end of the next request head, a client that does not send it in time is
+        // disconnected. Body bytes read along with it are passed on, the forwarder streams the rest
+        size_t headEnd = pending.find("\r\n\r\n");
+        TimerService::TimerId deadline = timers->arm(clientSocket, timers->phases().clientHeader);
+        while (headEnd == std::string::npos && pending.size() < MAX_REQUEST_HEAD) {
+            ssize_t bytesRead = recv(clientSocket, buffer, BUFFER_SIZE, 0);
+            if (bytesRead <= 0) {
+                break;
+            }
+            // Resume the terminator search a few bytes back in case it straddles two reads
+            size_t searchFrom = pending.size() < 3 ? 0 : pending.size() - 3;
+            pending.append(buffer, bytesRead);
+            headEnd = pending.find("\r\n\r\n", searchFrom);
+        }
+        // An idle keep-alive connection running out of time is not worth a log line
+        if (timers->cancel(deadline) && (handled == 0 || !pending.empty())) {
+            logger->log("request header timeout", clientId);
+        }
+        if (headEnd == std::string::npos) {
+            break;
+        }
+        std::string remainder;
+        keepAlive = requestHandler->handleRequest(pending, clientSocket, clientId, remainder);
+        pending.swap(remainder);
+        ++handled;
     }
     close(clientSocket);
 }
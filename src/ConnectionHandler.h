@@ -4,6 +4,7 @@
 #include <memory>
 #include "RequestHandler.h"
 #include "Logger.h"
+#include "TimerService.h"
 
 class ConnectionHandler {
 private:
@@ -11,11 +12,13 @@ private:
     std::vector<std::thread> clientThreads;
     std::shared_ptr<RequestHandler> requestHandler;
     std::shared_ptr<Logger> logger;
+    std::shared_ptr<TimerService> timers;
     int serverSocket;
     int id;
 
 public:
-    ConnectionHandler(std::shared_ptr<RequestHandler> handler, std::shared_ptr<Logger> logger);
+    ConnectionHandler(std::shared_ptr<RequestHandler> handler, std::shared_ptr<Logger> logger,
+                      std::shared_ptr<TimerService> timers = nullptr);
     ~ConnectionHandler();
 
     void start(int port);
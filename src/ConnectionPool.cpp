@@ -0,0 +1,172 @@
+#include "ConnectionPool.h"
+#include <poll.h>
+#include <unistd.h>
+
+// Connections idle for less than this are handed out without a liveness syscall
+#define TRUSTED_IDLE_MS 1000
+
+ConnectionPool::ConnectionPool(size_t maxIdlePerHost, size_t maxIdleTotal, std::chrono::seconds idleTimeout)
+    : maxIdlePerHost(maxIdlePerHost), maxIdleTotal(maxIdleTotal), idleTimeout(idleTimeout),
+      idleCount(0), lastSweep(Clock::now()), stats() {}
+
+ConnectionPool::~ConnectionPool() {
+    for (auto& host : idle) {
+        for (auto& conn : host.second) {
+            close(conn.fd);
+        }
+    }
+}
+
+std::string ConnectionPool::key(const std::string& host, const std::string& port) {
+    return host + ":" + port;
+}
+
+/**
+ * @brief: Pop the most recently used idle connection to host:port, or -1 if none is usable
+ */
+int ConnectionPool::acquire(const std::string& host, const std::string& port) {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    Clock::time_point now = Clock::now();
+    sweepLocked(now);
+    auto it = idle.find(key(host, port));
+    if (it == idle.end()) {
+        return -1;
+    }
+    std::vector<IdleConnection>& stack = it->second;
+    while (!stack.empty()) {
+        IdleConnection conn = stack.back();
+        stack.pop_back();
+        --idleCount;
+        if (isAlive(conn, now)) {
+            if (conn.speculative) {
+                ++stats.preconnectUsed;
+            }
+            return conn.fd;
+        }
+        discardLocked(conn);
+        ++stats.staleClosed;
+    }
+    return -1;
+}
+
+/**
+ * @brief: Hand a connection whose response was read completely back for reuse.
+ *         speculative marks a fresh connection opened ahead of demand.
+ */
+void ConnectionPool::release(const std::string& host, const std::string& port, int fd, bool speculative) {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    Clock::time_point now = Clock::now();
+    IdleConnection conn;
+    conn.fd = fd;
+    conn.since = now;
+    conn.speculative = speculative;
+    // A cap of zero disables pooling, there is nothing to make room in
+    if (maxIdlePerHost == 0 || maxIdleTotal == 0) {
+        discardLocked(conn);
+        return;
+    }
+    std::vector<IdleConnection>& stack = idle[key(host, port)];
+    if (stack.size() >= maxIdlePerHost) {
+        // The bottom of the stack is the connection idle the longest
+        discardLocked(stack.front());
+        stack.erase(stack.begin());
+        --idleCount;
+    }
+    if (idleCount >= maxIdleTotal) {
+        closeOldestLocked();
+    }
+    stack.push_back(conn);
+    ++idleCount;
+}
+
+size_t ConnectionPool::idleFor(const std::string& host, const std::string& port) {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    auto it = idle.find(key(host, port));
+    return it == idle.end() ? 0 : it->second.size();
+}
+
+void ConnectionPool::recordWait(bool hit, std::chrono::microseconds wait) {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (hit) {
+        ++stats.hits;
+    } else {
+        ++stats.misses;
+    }
+    uint64_t micros = static_cast<uint64_t>(wait.count());
+    stats.totalWaitMicros += micros;
+    if (micros > stats.maxWaitMicros) {
+        stats.maxWaitMicros = micros;
+    }
+}
+
+ConnectionPool::Stats ConnectionPool::getStats() {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    Stats copy = stats;
+    copy.idle = idleCount;
+    return copy;
+}
+
+/**
+ * @brief: An idle connection must not be readable: data or EOF means the server closed
+ *         it or broke framing. One poll() with zero timeout, skipped for very fresh ones.
+ */
+bool ConnectionPool::isAlive(const IdleConnection& conn, Clock::time_point now) const {
+    if (now - conn.since >= idleTimeout) {
+        return false;
+    }
+    if (now - conn.since < std::chrono::milliseconds(TRUSTED_IDLE_MS)) {
+        return true;
+    }
+    struct pollfd pfd;
+    pfd.fd = conn.fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) == 0;
+}
+
+// Close a connection that leaves the pool unused. Caller must hold poolMutex
+void ConnectionPool::discardLocked(const IdleConnection& conn) {
+    close(conn.fd);
+    if (conn.speculative) {
+        ++stats.preconnectWasted;
+    }
+}
+
+// Caller must hold poolMutex
+void ConnectionPool::closeOldestLocked() {
+    std::vector<IdleConnection>* oldestStack = nullptr;
+    for (auto& host : idle) {
+        if (!host.second.empty() && (oldestStack == nullptr || host.second.front().since < oldestStack->front().since)) {
+            oldestStack = &host.second;
+        }
+    }
+    if (oldestStack != nullptr) {
+        discardLocked(oldestStack->front());
+        oldestStack->erase(oldestStack->begin());
+        --idleCount;
+    }
+}
+
+// Close connections past the idle timeout, at most once a second. Caller must hold poolMutex
+void ConnectionPool::sweepLocked(Clock::time_point now) {
+    if (now - lastSweep < std::chrono::seconds(1)) {
+        return;
+    }
+    lastSweep = now;
+    for (auto it = idle.begin(); it != idle.end();) {
+        std::vector<IdleConnection>& stack = it->second;
+        size_t expired = 0;
+        while (expired < stack.size() && now - stack[expired].since >= idleTimeout) {
+            discardLocked(stack[expired]);
+            ++expired;
+        }
+        stack.erase(stack.begin(), stack.begin() + expired);
+        idleCount -= expired;
+        stats.staleClosed += expired;
+        if (stack.empty()) {
+            it = idle.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+/**
+ * Process-wide pool of idle keep-alive connections to origin servers. Each host:port
+ * keeps a LIFO stack of idle sockets so the most recently used (and most likely still
+ * open) connection is handed out first.
+ */
+class ConnectionPool {
+public:
+    struct Stats {
+        uint64_t hits;            // acquisitions served by an idle connection
+        uint64_t misses;          // acquisitions that had to dial
+        uint64_t staleClosed;     // idle connections found dead or expired
+        uint64_t totalWaitMicros; // time spent getting a usable connection
+        uint64_t maxWaitMicros;
+        uint64_t preconnectUsed;   // speculative connections handed to a request
+        uint64_t preconnectWasted; // speculative connections closed without ever being used
+        size_t idle;
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    struct IdleConnection {
+        int fd;
+        Clock::time_point since;
+        bool speculative;  // opened ahead of demand and not used yet
+    };
+
+    std::unordered_map<std::string, std::vector<IdleConnection>> idle;
+    std::mutex poolMutex;
+    size_t maxIdlePerHost;
+    size_t maxIdleTotal;
+    std::chrono::seconds idleTimeout;
+    size_t idleCount;
+    Clock::time_point lastSweep;
+    Stats stats;
+
+    static std::string key(const std::string& host, const std::string& port);
+    bool isAlive(const IdleConnection& conn, Clock::time_point now) const;
+    void discardLocked(const IdleConnection& conn);
+    void closeOldestLocked();
+    void sweepLocked(Clock::time_point now);
+
+public:
+    ConnectionPool(size_t maxIdlePerHost = 8, size_t maxIdleTotal = 256,
+                   std::chrono::seconds idleTimeout = std::chrono::seconds(30));
+    ~ConnectionPool();
+
+    int acquire(const std::string& host, const std::string& port);
+    void release(const std::string& host, const std::string& port, int fd, bool speculative = false);
+    size_t idleFor(const std::string& host, const std::string& port);
+    void recordWait(bool hit, std::chrono::microseconds wait);
+    Stats getStats();
+};
@@ -0,0 +1,205 @@
+#include "Dialer.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <algorithm>
+
+Dialer::Dialer(std::shared_ptr<DnsResolver> resolver, std::chrono::milliseconds attemptDelay,
+               std::chrono::milliseconds timeout, std::chrono::seconds failureMemory)
+    : resolver(resolver), attemptDelay(attemptDelay), timeout(timeout), failureMemory(failureMemory), stats() {}
+
+/**
+ * @brief: Connect to host:port, racing its addresses. A new attempt starts every attemptDelay,
+ *         or right away when the previous one fails, until one connects or timeout passes.
+ *         Returns a blocking socket, or -1 with result telling which step failed. resolveTime,
+ *         when set, receives how long the name lookup took.
+ */
+int Dialer::dial(const std::string& host, const std::string& port, Result& result,
+                 std::chrono::microseconds* resolveTime, int cancelFd) {
+    std::vector<DnsResolver::Address> resolved;
+    Clock::time_point lookupStart = Clock::now();
+    bool found = resolver->resolve(host, resolved);
+    if (resolveTime != nullptr) {
+        *resolveTime = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - lookupStart);
+    }
+    if (!found) {
+        result = DNS_FAILURE;
+        return -1;
+    }
+    std::vector<DnsResolver::Address> candidates =
+        orderAddresses(resolved, static_cast<uint16_t>(atoi(port.c_str())));
+
+    struct Attempt {
+        int fd;
+        size_t index;
+    };
+    std::vector<Attempt> attempts;
+    size_t next = 0;
+    int winner = -1;
+    size_t winnerIndex = 0;
+    uint64_t started = 0;
+    bool cancelled = false;
+    Clock::time_point deadline = Clock::now() + timeout;
+    Clock::time_point nextStart = Clock::now();
+
+    while (winner < 0) {
+        Clock::time_point now = Clock::now();
+        if (now >= deadline) {
+            break;
+        }
+        // Start the next address when its turn has come or nothing else is in flight
+        if (next < candidates.size() && (now >= nextStart || attempts.empty())) {
+            const DnsResolver::Address& address = candidates[next];
+            int fd = socket(address.addr.ss_family, SOCK_STREAM, 0);
+            if (fd >= 0) {
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+                ++started;
+                if (connect(fd, reinterpret_cast<const struct sockaddr*>(&address.addr), address.length) == 0) {
+                    winner = fd;
+                    winnerIndex = next;
+                } else if (errno == EINPROGRESS) {
+                    attempts.push_back({fd, next});
+                } else {
+                    close(fd);
+                    recordFailure(address);
+                }
+            }
+            ++next;
+            nextStart = now + attemptDelay;
+            continue;
+        }
+        if (attempts.empty()) {
+            break;  // every address failed
+        }
+
+        // Wait for an attempt to finish, the next stagger slot or the deadline
+        Clock::time_point wakeup = deadline;
+        if (next < candidates.size() && nextStart < wakeup) {
+            wakeup = nextStart;
+        }
+        int waitMs = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(wakeup - now).count()) + 1;
+        std::vector<struct pollfd> fds;
+        for (const Attempt& attempt : attempts) {
+            fds.push_back({attempt.fd, POLLOUT, 0});
+        }
+        if (cancelFd >= 0) {
+            fds.push_back({cancelFd, POLLIN, 0});
+        }
+        if (poll(fds.data(), fds.size(), waitMs) < 0 && errno != EINTR) {
+            break;
+        }
+        if (cancelFd >= 0 && fds.back().revents != 0) {
+            cancelled = true;
+            break;
+        }
+        bool failed = false;
+        for (size_t i = attempts.size(); i-- > 0;) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            int soError = 0;
+            socklen_t length = sizeof soError;
+            getsockopt(attempts[i].fd, SOL_SOCKET, SO_ERROR, &soError, &length);
+            if (soError == 0 && winner < 0) {
+                winner = attempts[i].fd;
+                winnerIndex = attempts[i].index;
+            } else {
+                close(attempts[i].fd);
+                if (soError != 0) {
+                    recordFailure(candidates[attempts[i].index]);
+                    failed = true;
+                }
+            }
+            attempts.erase(attempts.begin() + i);
+        }
+        // A refused address hands its turn to the next one immediately
+        if (failed) {
+            nextStart = Clock::now();
+        }
+    }
+
+    // Losers are closed, attempts still pending at the deadline count as failed addresses
+    for (const Attempt& attempt : attempts) {
+        close(attempt.fd);
+        if (winner < 0 && !cancelled) {
+            recordFailure(candidates[attempt.index]);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(dialerMutex);
+    ++stats.dials;
+    stats.attempts += started;
+    if (winner < 0) {
+        result = cancelled ? CANCELLED : CONNECT_FAILURE;
+        return -1;
+    }
+    if (candidates[winnerIndex].addr.ss_family == AF_INET6) {
+        ++stats.ipv6Wins;
+    } else {
+        ++stats.ipv4Wins;
+    }
+    failedAddresses.erase(addressKey(candidates[winnerIndex]));
+    fcntl(winner, F_SETFL, fcntl(winner, F_GETFL, 0) & ~O_NONBLOCK);
+    result = CONNECTED;
+    return winner;
+}
+
+Dialer::Stats Dialer::getStats() {
+    std::lock_guard<std::mutex> lock(dialerMutex);
+    return stats;
+}
+
+/**
+ * @brief: Set the port and interleave the families, starting with the resolver's preferred
+ *         one. Addresses that failed within failureMemory go to the back of the list.
+ */
+std::vector<DnsResolver::Address> Dialer::orderAddresses(const std::vector<DnsResolver::Address>& addresses, uint16_t port) {
+    std::vector<DnsResolver::Address> preferred;
+    std::vector<DnsResolver::Address> other;
+    for (DnsResolver::Address address : addresses) {
+        if (address.addr.ss_family == AF_INET) {
+            reinterpret_cast<struct sockaddr_in*>(&address.addr)->sin_port = htons(port);
+        } else {
+            reinterpret_cast<struct sockaddr_in6*>(&address.addr)->sin6_port = htons(port);
+        }
+        (address.addr.ss_family == addresses.front().addr.ss_family ? preferred : other).push_back(address);
+    }
+    std::vector<DnsResolver::Address> ordered;
+    for (size_t i = 0; i < preferred.size() || i < other.size(); ++i) {
+        if (i < preferred.size()) {
+            ordered.push_back(preferred[i]);
+        }
+        if (i < other.size()) {
+            ordered.push_back(other[i]);
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(dialerMutex);
+    Clock::time_point now = Clock::now();
+    for (auto it = failedAddresses.begin(); it != failedAddresses.end();) {
+        if (now - it->second >= failureMemory) {
+            it = failedAddresses.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    std::stable_partition(ordered.begin(), ordered.end(), [this](const DnsResolver::Address& address) {
+        return failedAddresses.count(addressKey(address)) == 0;
+    });
+    return ordered;
+}
+
+void Dialer::recordFailure(const DnsResolver::Address& address) {
+    std::lock_guard<std::mutex> lock(dialerMutex);
+    ++stats.addressFailures;
+    failedAddresses[addressKey(address)] = Clock::now();
+}
+
+// The raw sockaddr bytes identify an address and port
+std::string Dialer::addressKey(const DnsResolver::Address& address) {
+    return std::string(reinterpret_cast<const char*>(&address.addr), address.length);
+}
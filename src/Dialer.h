@@ -0,0 +1,54 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include "DnsResolver.h"
+
+/**
+ * Opens upstream TCP connections the RFC 8305 (Happy Eyeballs) way: the resolved
+ * addresses are interleaved by family and attempted one after another with a short
+ * stagger, the first to connect wins and the rest are closed. Addresses that failed
+ * recently are tried last.
+ */
+class Dialer {
+public:
+    enum Result { CONNECTED, DNS_FAILURE, CONNECT_FAILURE, CANCELLED };
+
+    struct Stats {
+        uint64_t dials;
+        uint64_t attempts;        // connect() calls across all dials
+        uint64_t ipv4Wins;
+        uint64_t ipv6Wins;
+        uint64_t addressFailures; // single addresses that refused or timed out
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    std::shared_ptr<DnsResolver> resolver;
+    std::chrono::milliseconds attemptDelay;
+    std::chrono::milliseconds timeout;
+    std::chrono::seconds failureMemory;
+    // Recently failed addresses (sockaddr bytes including the port) and when they failed
+    std::unordered_map<std::string, Clock::time_point> failedAddresses;
+    std::mutex dialerMutex;
+    Stats stats;
+
+    std::vector<DnsResolver::Address> orderAddresses(const std::vector<DnsResolver::Address>& addresses, uint16_t port);
+    void recordFailure(const DnsResolver::Address& address);
+    static std::string addressKey(const DnsResolver::Address& address);
+
+public:
+    Dialer(std::shared_ptr<DnsResolver> resolver,
+           std::chrono::milliseconds attemptDelay = std::chrono::milliseconds(250),
+           std::chrono::milliseconds timeout = std::chrono::milliseconds(5000),
+           std::chrono::seconds failureMemory = std::chrono::seconds(60));
+
+    int dial(const std::string& host, const std::string& port, Result& result,
+             std::chrono::microseconds* resolveTime = nullptr, int cancelFd = -1);
+    Stats getStats();
+};
@@ -0,0 +1,209 @@
+#include "DnsResolver.h"
+#include <netdb.h>
+#include <cstring>
+#include <arpa/nameser.h>
+#include <arpa/inet.h>
+
+// Bounds on the record TTLs honoured, so a zero TTL does not mean a query per request
+#define MIN_RECORD_TTL_SECONDS 1
+// Answers without a DNS record behind them (hosts file, failed TTL query) live this long
+#define UNKNOWN_TTL_SECONDS 30
+
+DnsResolver::DnsResolver(size_t threads, std::chrono::seconds maxTtl, std::chrono::seconds failureTtl,
+                         std::chrono::milliseconds timeout, size_t maxRecords)
+    : maxTtl(maxTtl), failureTtl(failureTtl), timeout(timeout), maxRecords(maxRecords), stopping(false), stats() {
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back(&DnsResolver::workerLoop, this);
+    }
+}
+
+DnsResolver::~DnsResolver() {
+    {
+        std::lock_guard<std::mutex> lock(resolverMutex);
+        stopping = true;
+    }
+    queueReady.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+/**
+ * @brief: Addresses of host, from the cache when fresh. On a miss the caller waits (at most
+ *         timeout) for the resolver threads; a name already being looked up is not queried twice.
+ */
+bool DnsResolver::resolve(const std::string& host, std::vector<Address>& addresses) {
+    std::unique_lock<std::mutex> lock(resolverMutex);
+    Clock::time_point now = Clock::now();
+    pruneLocked(now);
+    Record& record = records[host];
+
+    if (!record.addresses.empty() && now < record.expiry) {
+        ++stats.hits;
+        // Hot name in the last fifth of its TTL: refresh in the background, keep serving this answer
+        if (!record.pending && record.expiry - now < record.lifetime / 5) {
+            ++stats.refreshes;
+            enqueueLocked(host, record);
+        }
+        addresses = record.addresses;
+        return true;
+    }
+    if (record.failed && now < record.expiry && !record.pending) {
+        return false;
+    }
+
+    if (record.pending) {
+        ++stats.coalesced;
+    } else {
+        ++stats.misses;
+        enqueueLocked(host, record);
+    }
+    if (!resultReady.wait_for(lock, timeout, [&record]() { return !record.pending; })) {
+        return false;
+    }
+    if (record.failed || record.addresses.empty()) {
+        return false;
+    }
+    addresses = record.addresses;
+    return true;
+}
+
+DnsResolver::Stats DnsResolver::getStats() {
+    std::lock_guard<std::mutex> lock(resolverMutex);
+    return stats;
+}
+
+// Caller must hold resolverMutex
+void DnsResolver::enqueueLocked(const std::string& host, Record& record) {
+    record.pending = true;
+    queue.push_back(host);
+    queueReady.notify_one();
+}
+
+// Drop expired, idle records once the table is over its cap. Caller must hold resolverMutex
+void DnsResolver::pruneLocked(Clock::time_point now) {
+    if (records.size() < maxRecords) {
+        return;
+    }
+    for (auto it = records.begin(); it != records.end();) {
+        if (!it->second.pending && it->second.expiry <= now) {
+            it = records.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/**
+ * @brief: TTL of host's records of this family: the smallest over the answer section, so
+ *         a CNAME on the way counts too. Zero when the name has no such records in DNS,
+ *         as for names from the hosts file.
+ */
+std::chrono::seconds DnsResolver::recordTtl(struct __res_state& state, const std::string& host, int family) {
+    int type = family == AF_INET6 ? ns_t_aaaa : ns_t_a;
+    unsigned char answer[4096];
+    int length = res_nquery(&state, host.c_str(), ns_c_in, type, answer, sizeof(answer));
+    ns_msg message;
+    if (length <= 0 || ns_initparse(answer, length, &message) < 0) {
+        return std::chrono::seconds(0);
+    }
+    uint32_t smallest = 0;
+    bool found = false;
+    for (int i = 0; i < ns_msg_count(message, ns_s_an); ++i) {
+        ns_rr record;
+        if (ns_parserr(&message, ns_s_an, i, &record) < 0) {
+            break;
+        }
+        smallest = found ? std::min<uint32_t>(smallest, ns_rr_ttl(record)) : ns_rr_ttl(record);
+        found = found || ns_rr_type(record) == type;
+    }
+    if (!found) {
+        return std::chrono::seconds(0);
+    }
+    return std::chrono::seconds(std::max<uint32_t>(smallest, MIN_RECORD_TTL_SECONDS));
+}
+
+/**
+ * @brief: Resolver thread: run queued getaddrinfo calls and publish the results. The
+ *         addresses come from getaddrinfo so the hosts file and nsswitch keep working;
+ *         the TTL of the answer comes from a DNS query of the same name.
+ */
+void DnsResolver::workerLoop() {
+    struct __res_state state;
+    memset(&state, 0, sizeof(state));
+    bool haveResolver = res_ninit(&state) == 0;
+    while (true) {
+        std::string host;
+        {
+            std::unique_lock<std::mutex> lock(resolverMutex);
+            queueReady.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (stopping) {
+                break;
+            }
+            host = queue.front();
+            queue.pop_front();
+        }
+
+        struct addrinfo hints, *res = nullptr;
+        memset(&hints, 0, sizeof hints);
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        std::vector<Address> result;
+        if (getaddrinfo(host.c_str(), nullptr, &hints, &res) == 0) {
+            for (struct addrinfo* ai = res; ai != nullptr; ai = ai->ai_next) {
+                Address address;
+                memset(&address.addr, 0, sizeof(address.addr));
+                memcpy(&address.addr, ai->ai_addr, ai->ai_addrlen);
+                address.length = ai->ai_addrlen;
+                result.push_back(address);
+            }
+            freeaddrinfo(res);
+        }
+        // Address literals have no records to ask about, other names get their TTL below
+        unsigned char literal[sizeof(struct in6_addr)];
+        bool queryTtl = haveResolver && !result.empty() && inet_pton(AF_INET, host.c_str(), literal) != 1 &&
+                        inet_pton(AF_INET6, host.c_str(), literal) != 1;
+        int family = result.empty() ? AF_UNSPEC : result.front().addr.ss_family;
+        Clock::time_point answered;
+        Clock::time_point published;
+        {
+            std::lock_guard<std::mutex> lock(resolverMutex);
+            Record& record = records[host];
+            Clock::time_point now = Clock::now();
+            record.pending = false;
+            if (!result.empty()) {
+                record.addresses.swap(result);
+                record.lifetime = std::min(std::chrono::seconds(UNKNOWN_TTL_SECONDS), maxTtl);
+                record.expiry = now + record.lifetime;
+                record.failed = false;
+                answered = now;
+                published = record.expiry;
+            } else {
+                ++stats.failures;
+                // A failed refresh keeps serving the previous answer until it expires
+                if (record.addresses.empty() || now >= record.expiry) {
+                    record.addresses.clear();
+                    record.failed = true;
+                    record.expiry = now + failureTtl;
+                }
+            }
+            resultReady.notify_all();
+        }
+
+        // Waiting callers already have the addresses, the TTL query only moves the expiry
+        std::chrono::seconds lifetime = queryTtl ? recordTtl(state, host, family) : std::chrono::seconds(0);
+        if (lifetime.count() == 0) {
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(resolverMutex);
+        auto it = records.find(host);
+        // Unless a newer answer replaced the one just published
+        if (it != records.end() && !it->second.failed && it->second.expiry == published) {
+            it->second.lifetime = std::min(lifetime, maxTtl);
+            it->second.expiry = answered + it->second.lifetime;
+        }
+    }
+    if (haveResolver) {
+        res_nclose(&state);
+    }
+}
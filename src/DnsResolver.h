@@ -0,0 +1,73 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <resolv.h>
+
+/**
+ * Caching resolver in front of getaddrinfo. Lookups run on a small pool of resolver
+ * threads, concurrent lookups of one name share a single query, and names that are
+ * still being used get refreshed in the background before they expire. Answers live
+ * as long as their DNS records say, read with res_nquery since getaddrinfo hides TTLs.
+ */
+class DnsResolver {
+public:
+    struct Address {
+        sockaddr_storage addr;
+        socklen_t length;
+    };
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t coalesced;   // lookups that waited on a query already in flight
+        uint64_t refreshes;   // background refreshes of names close to expiry
+        uint64_t failures;
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    struct Record {
+        std::vector<Address> addresses;
+        Clock::time_point expiry;
+        std::chrono::seconds lifetime;   // TTL the current answer was given
+        bool pending;   // a query is queued or running
+        bool failed;
+    };
+
+    std::unordered_map<std::string, Record> records;
+    std::deque<std::string> queue;
+    std::mutex resolverMutex;
+    std::condition_variable queueReady;
+    std::condition_variable resultReady;
+    std::vector<std::thread> workers;
+    std::chrono::seconds maxTtl;
+    std::chrono::seconds failureTtl;
+    std::chrono::milliseconds timeout;
+    size_t maxRecords;
+    bool stopping;
+    Stats stats;
+
+    void workerLoop();
+    void enqueueLocked(const std::string& host, Record& record);
+    void pruneLocked(Clock::time_point now);
+    std::chrono::seconds recordTtl(struct __res_state& state, const std::string& host, int family);
+
+public:
+    DnsResolver(size_t threads = 4, std::chrono::seconds maxTtl = std::chrono::seconds(3600),
+                std::chrono::seconds failureTtl = std::chrono::seconds(5),
+                std::chrono::milliseconds timeout = std::chrono::milliseconds(5000),
+                size_t maxRecords = 10000);
+    ~DnsResolver();
+
+    bool resolve(const std::string& host, std::vector<Address>& addresses);
+    Stats getStats();
+};
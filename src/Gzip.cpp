@@ -0,0 +1,65 @@
+#include "Gzip.h"
+#include <zlib.h>
+
+#define GZIP_CHUNK 16384
+
+/**
+ * @brief: Compress input into a gzip member (RFC 1952)
+ */
+bool gzipCompress(const std::string& input, std::string& output) {
+    z_stream zs = {};
+    // 15 window bits + 16 selects the gzip wrapper instead of zlib
+    if (deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    output.clear();
+    output.reserve(deflateBound(&zs, input.size()));
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    zs.avail_in = input.size();
+
+    char buffer[GZIP_CHUNK];
+    int result;
+    do {
+        zs.next_out = reinterpret_cast<Bytef*>(buffer);
+        zs.avail_out = sizeof(buffer);
+        result = deflate(&zs, Z_FINISH);
+        if (result == Z_STREAM_ERROR) {
+            deflateEnd(&zs);
+            return false;
+        }
+        output.append(buffer, sizeof(buffer) - zs.avail_out);
+    } while (result != Z_STREAM_END);
+
+    deflateEnd(&zs);
+    return true;
+}
+
+/**
+ * @brief: Inflate a gzip (or zlib) stream back to the original bytes
+ */
+bool gzipDecompress(const std::string& input, std::string& output) {
+    z_stream zs = {};
+    // 15 window bits + 32 detects the gzip or zlib header automatically
+    if (inflateInit2(&zs, 15 + 32) != Z_OK) {
+        return false;
+    }
+    output.clear();
+    zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    zs.avail_in = input.size();
+
+    char buffer[GZIP_CHUNK];
+    int result;
+    do {
+        zs.next_out = reinterpret_cast<Bytef*>(buffer);
+        zs.avail_out = sizeof(buffer);
+        result = inflate(&zs, Z_NO_FLUSH);
+        if (result != Z_OK && result != Z_STREAM_END) {
+            inflateEnd(&zs);
+            return false;
+        }
+        output.append(buffer, sizeof(buffer) - zs.avail_out);
+    } while (result != Z_STREAM_END);
+
+    inflateEnd(&zs);
+    return true;
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include <string>
+
+// gzip helpers on top of zlib, used to keep compressible cache bodies compressed at rest
+bool gzipCompress(const std::string& input, std::string& output);
+bool gzipDecompress(const std::string& input, std::string& output);
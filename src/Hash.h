@@ -0,0 +1,11 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+// 64-bit XXH64 hash (xxHash by Yann Collet), used to content-address cache bodies
+uint64_t hash64(const void* data, size_t length, uint64_t seed = 0);
+
+inline uint64_t hash64(const std::string& data, uint64_t seed = 0) {
+    return hash64(data.data(), data.size(), seed);
+}
@@ -0,0 +1,169 @@
+#include "HeaderMap.h"
+#include <string>
+#include <strings.h>
+
+// Slots in the perfect hash table, a power of two well above the number of known names
+#define HEADER_TABLE_SIZE 128
+
+namespace {
+
+// Indexed by HeaderMap::Id
+constexpr const char* NAMES[] = {
+    "Accept",
+    "Accept-Encoding",
+    "Accept-Language",
+    "Age",
+    "Authorization",
+    "Cache-Control",
+    "Connection",
+    "Content-Encoding",
+    "Content-Length",
+    "Content-Range",
+    "Content-Type",
+    "Cookie",
+    "Date",
+    "ETag",
+    "Expect",
+    "Expires",
+    "Host",
+    "If-Modified-Since",
+    "If-None-Match",
+    "If-Range",
+    "Keep-Alive",
+    "Last-Modified",
+    "Location",
+    "Pragma",
+    "Proxy-Authorization",
+    "Proxy-Connection",
+    "Range",
+    "Referer",
+    "Set-Cookie",
+    "TE",
+    "Trailer",
+    "Transfer-Encoding",
+    "Upgrade",
+    "User-Agent",
+    "Vary",
+    "Via",
+    "X-Forwarded-For",
+};
+static_assert(sizeof(NAMES) / sizeof(NAMES[0]) == HeaderMap::KNOWN_COUNT, "header names out of step with HeaderMap::Id");
+static_assert(HeaderMap::KNOWN_COUNT <= 64, "presence bits do not fit");
+
+constexpr char lower(char c) {
+    return c >= 'A' && c <= 'Z' ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// FNV-1a over the lowercased name, salted with seed. The final mix spreads the high bits
+// into the low ones the table index is taken from
+constexpr uint32_t hashName(const char* name, size_t length, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<uint8_t>(lower(name[i]));
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3bu;
+    return hash ^ (hash >> 16);
+}
+
+struct PerfectHash {
+    uint32_t seed;
+    uint8_t slots[HEADER_TABLE_SIZE];   // Id per slot, UNKNOWN where no name lands
+};
+
+// Try seeds until every known name lands in a slot of its own
+constexpr PerfectHash buildTable() {
+    PerfectHash table{};
+    for (uint32_t seed = 1; seed < 65536; ++seed) {
+        for (size_t slot = 0; slot < HEADER_TABLE_SIZE; ++slot) {
+            table.slots[slot] = HeaderMap::UNKNOWN;
+        }
+        bool collision = false;
+        for (size_t id = 0; id < HeaderMap::KNOWN_COUNT && !collision; ++id) {
+            size_t slot = hashName(NAMES[id], std::char_traits<char>::length(NAMES[id]), seed) % HEADER_TABLE_SIZE;
+            collision = table.slots[slot] != HeaderMap::UNKNOWN;
+            table.slots[slot] = static_cast<uint8_t>(id);
+        }
+        if (!collision) {
+            table.seed = seed;
+            return table;
+        }
+    }
+    return table;
+}
+
+constexpr PerfectHash TABLE = buildTable();
+static_assert(TABLE.seed != 0, "no perfect hash seed for the known header names");
+
+const std::string EMPTY;
+
+} // namespace
+
+HeaderMap::Id HeaderMap::lookup(const char* name, size_t length) {
+    uint8_t id = TABLE.slots[hashName(name, length, TABLE.seed) % HEADER_TABLE_SIZE];
+    if (id == UNKNOWN || std::char_traits<char>::length(NAMES[id]) != length ||
+        strncasecmp(name, NAMES[id], length) != 0) {
+        return UNKNOWN;
+    }
+    return static_cast<Id>(id);
+}
+
+void HeaderMap::set(const std::string& name, const std::string& value) {
+    Id id = lookup(name);
+    if (id != UNKNOWN) {
+        known[id].name = name;
+        known[id].value = value;
+        present |= uint64_t(1) << id;
+        return;
+    }
+    size_t index = findUnknown(name.data(), name.size());
+    if (index < unknown.size()) {
+        unknown[index].value = value;
+    } else {
+        unknown.push_back(Field{name, value});
+    }
+}
+
+bool HeaderMap::erase(Id id) {
+    if (!has(id)) {
+        return false;
+    }
+    present &= ~(uint64_t(1) << id);
+    known[id].name.clear();
+    known[id].value.clear();
+    return true;
+}
+
+bool HeaderMap::has(const char* name) const {
+    return find(name) != nullptr;
+}
+
+const std::string* HeaderMap::find(const char* name) const {
+    size_t length = std::char_traits<char>::length(name);
+    Id id = lookup(name, length);
+    if (id != UNKNOWN) {
+        return find(id);
+    }
+    size_t index = findUnknown(name, length);
+    return index < unknown.size() ? &unknown[index].value : nullptr;
+}
+
+const std::string& HeaderMap::get(Id id) const {
+    return has(id) ? known[id].value : EMPTY;
+}
+
+size_t HeaderMap::size() const {
+    return __builtin_popcountll(present) + unknown.size();
+}
+
+// Index of an unknown field, unknown.size() if there is none. The vector stays short,
+// a linear scan beats hashing here
+size_t HeaderMap::findUnknown(const char* name, size_t length) const {
+    size_t index = 0;
+    while (index < unknown.size() && (unknown[index].name.size() != length ||
+                                      strncasecmp(unknown[index].name.data(), name, length) != 0)) {
+        ++index;
+    }
+    return index;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * Header fields of one message. Well-known names are interned: a compile-time perfect hash
+ * maps them to an Id, and their field sits in a fixed slot. Other names go to a small flat
+ * vector. Lookups match names case-insensitively and never allocate. Names keep the case
+ * they arrived in. A repeated field replaces the earlier one.
+ */
+class HeaderMap {
+public:
+    // Keep in step with the names table in HeaderMap.cpp
+    enum Id {
+        ACCEPT,
+        ACCEPT_ENCODING,
+        ACCEPT_LANGUAGE,
+        AGE,
+        AUTHORIZATION,
+        CACHE_CONTROL,
+        CONNECTION,
+        CONTENT_ENCODING,
+        CONTENT_LENGTH,
+        CONTENT_RANGE,
+        CONTENT_TYPE,
+        COOKIE,
+        DATE,
+        ETAG,
+        EXPECT,
+        EXPIRES,
+        HOST,
+        IF_MODIFIED_SINCE,
+        IF_NONE_MATCH,
+        IF_RANGE,
+        KEEP_ALIVE,
+        LAST_MODIFIED,
+        LOCATION,
+        PRAGMA,
+        PROXY_AUTHORIZATION,
+        PROXY_CONNECTION,
+        RANGE,
+        REFERER,
+        SET_COOKIE,
+        TE,
+        TRAILER,
+        TRANSFER_ENCODING,
+        UPGRADE,
+        USER_AGENT,
+        VARY,
+        VIA,
+        X_FORWARDED_FOR,
+        KNOWN_COUNT,
+        UNKNOWN = KNOWN_COUNT
+    };
+
+    struct Field {
+        std::string name;
+        std::string value;
+    };
+
+private:
+    Field known[KNOWN_COUNT];
+    uint64_t present;          // bit per known Id
+    std::vector<Field> unknown;
+
+    size_t findUnknown(const char* name, size_t length) const;
+
+public:
+    HeaderMap() : present(0) {}
+
+    static Id lookup(const char* name, size_t length);
+    static Id lookup(const std::string& name) { return lookup(name.data(), name.size()); }
+
+    void set(const std::string& name, const std::string& value);
+    bool erase(Id id);
+    bool has(Id id) const { return (present >> id) & 1; }
+    bool has(const char* name) const;
+    const std::string* find(Id id) const { return has(id) ? &known[id].value : nullptr; }
+    const std::string* find(const char* name) const;
+    // Value of the field, empty when it is absent
+    const std::string& get(Id id) const;
+    size_t size() const;
+
+    // Calls visit(id, field) for every field, known ones first in Id order
+    template <typename Visitor>
+    void forEach(Visitor visit) const {
+        for (int id = 0; id < KNOWN_COUNT; ++id) {
+            if (has(static_cast<Id>(id))) {
+                visit(static_cast<Id>(id), known[id]);
+            }
+        }
+        for (const Field& field : unknown) {
+            visit(UNKNOWN, field);
+        }
+    }
+};
@@ -0,0 +1,190 @@
+#include "HealthTracker.h"
+#include <algorithm>
+
+// Weight of the newest sample in the moving averages
+#define HEALTH_EWMA_ALPHA 0.1
+// Latency samples kept per origin for percentiles, and how many are needed before using them
+#define LATENCY_WINDOW 128
+#define MIN_PERCENTILE_SAMPLES 20
+// Healthy origins not heard from for this long are forgotten when the table is full
+#define ORIGIN_IDLE_SECONDS 300
+
+HealthTracker::HealthTracker(unsigned failureThreshold, double errorRateThreshold, uint64_t minSamples,
+                             std::chrono::seconds openDuration, std::chrono::seconds maxOpenDuration,
+                             size_t maxOrigins)
+    : failureThreshold(failureThreshold), errorRateThreshold(errorRateThreshold), minSamples(minSamples),
+      openDuration(openDuration), maxOpenDuration(maxOpenDuration), maxOrigins(std::max<size_t>(maxOrigins, 1)),
+      stats() {}
+
+/**
+ * @brief: Whether a request may go to host:port. An open circuit refuses until its open
+ *         time is over and then lets exactly one probe through.
+ */
+bool HealthTracker::allow(const std::string& host, const std::string& port) {
+    std::lock_guard<std::mutex> lock(healthMutex);
+    auto it = origins.find(host + ":" + port);
+    if (it == origins.end() || it->second.health.state == CLOSED) {
+        return true;
+    }
+    Origin& origin = it->second;
+    Clock::time_point now = Clock::now();
+    if (origin.health.state == OPEN && now - origin.openedAt < openTimeLocked(origin)) {
+        ++stats.rejected;
+        return false;
+    }
+    // A probe that never reported back does not block the origin forever
+    if (origin.health.state == HALF_OPEN && origin.probing && now - origin.probeStarted < openDuration) {
+        ++stats.rejected;
+        return false;
+    }
+    origin.health.state = HALF_OPEN;
+    origin.probing = true;
+    origin.probeStarted = now;
+    ++stats.probes;
+    return true;
+}
+
+/**
+ * @brief: Whether host:port is in normal operation. Unlike allow this never takes the
+ *         probe of a half-open circuit, for work that can simply be skipped.
+ */
+bool HealthTracker::healthy(const std::string& host, const std::string& port) {
+    std::lock_guard<std::mutex> lock(healthMutex);
+    auto it = origins.find(host + ":" + port);
+    return it == origins.end() || it->second.health.state == CLOSED;
+}
+
+void HealthTracker::recordSuccess(const std::string& host, const std::string& port, std::chrono::microseconds latency) {
+    std::lock_guard<std::mutex> lock(healthMutex);
+    Origin& origin = originLocked(host + ":" + port, Clock::now());
+    OriginHealth& health = origin.health;
+    double ms = latency.count() / 1000.0;
+    health.latencyMs = health.samples == 0 ? ms : HEALTH_EWMA_ALPHA * ms + (1 - HEALTH_EWMA_ALPHA) * health.latencyMs;
+    health.errorRate *= 1 - HEALTH_EWMA_ALPHA;
+    health.consecutiveFailures = 0;
+    ++health.samples;
+    uint32_t micros = static_cast<uint32_t>(std::min<int64_t>(latency.count(), UINT32_MAX));
+    if (origin.recentLatency.size() < LATENCY_WINDOW) {
+        origin.recentLatency.push_back(micros);
+    } else {
+        origin.recentLatency[origin.nextSample] = micros;
+    }
+    origin.nextSample = (origin.nextSample + 1) % LATENCY_WINDOW;
+    if (health.state != CLOSED) {
+        health.state = CLOSED;
+        origin.probing = false;
+        origin.trips = 0;
+    }
+}
+
+void HealthTracker::recordFailure(const std::string& host, const std::string& port) {
+    std::lock_guard<std::mutex> lock(healthMutex);
+    Clock::time_point now = Clock::now();
+    Origin& origin = originLocked(host + ":" + port, now);
+    OriginHealth& health = origin.health;
+    health.errorRate = HEALTH_EWMA_ALPHA + (1 - HEALTH_EWMA_ALPHA) * health.errorRate;
+    ++health.consecutiveFailures;
+    ++health.samples;
+    if (health.state == HALF_OPEN) {
+        // The probe failed, stay open for longer
+        tripLocked(origin, now);
+    } else if (health.state == CLOSED &&
+               (health.consecutiveFailures >= failureThreshold ||
+                (health.samples >= minSamples && health.errorRate >= errorRateThreshold))) {
+        tripLocked(origin, now);
+    }
+}
+
+bool HealthTracker::getOrigin(const std::string& host, const std::string& port, OriginHealth& health) {
+    std::lock_guard<std::mutex> lock(healthMutex);
+    auto it = origins.find(host + ":" + port);
+    if (it == origins.end()) {
+        return false;
+    }
+    health = it->second.health;
+    return true;
+}
+
+/**
+ * @brief: Latency at quantile (0..1) over the origin's recent successful exchanges.
+ *         False until enough samples were seen.
+ */
+bool HealthTracker::latencyPercentile(const std::string& host, const std::string& port, double quantile,
+                                      std::chrono::microseconds& latency) {
+    std::vector<uint32_t> samples;
+    {
+        std::lock_guard<std::mutex> lock(healthMutex);
+        auto it = origins.find(host + ":" + port);
+        if (it == origins.end() || it->second.recentLatency.size() < MIN_PERCENTILE_SAMPLES) {
+            return false;
+        }
+        samples = it->second.recentLatency;
+    }
+    size_t rank = std::min(samples.size() - 1, static_cast<size_t>(quantile * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+    latency = std::chrono::microseconds(samples[rank]);
+    return true;
+}
+
+HealthTracker::Stats HealthTracker::getStats() {
+    std::lock_guard<std::mutex> lock(healthMutex);
+    Stats copy = stats;
+    copy.origins = origins.size();
+    copy.openCircuits = 0;
+    for (const auto& origin : origins) {
+        if (origin.second.health.state != CLOSED) {
+            ++copy.openCircuits;
+        }
+    }
+    return copy;
+}
+
+/**
+ * @brief: The entry of an origin, created when missing. The table never grows past
+ *         maxOrigins: when full, healthy origins idle for ORIGIN_IDLE_SECONDS are swept and
+ *         if that frees nothing the least recently seen origin goes, a healthy one first.
+ *         Caller must hold healthMutex.
+ */
+HealthTracker::Origin& HealthTracker::originLocked(const std::string& key, Clock::time_point now) {
+    auto it = origins.find(key);
+    if (it == origins.end() && origins.size() >= maxOrigins) {
+        auto victim = origins.end();
+        for (auto candidate = origins.begin(); candidate != origins.end();) {
+            bool closed = candidate->second.health.state == CLOSED;
+            if (closed && now - candidate->second.lastSeen >= std::chrono::seconds(ORIGIN_IDLE_SECONDS)) {
+                candidate = origins.erase(candidate);
+                continue;
+            }
+            if (victim == origins.end() || (closed && victim->second.health.state != CLOSED) ||
+                (closed == (victim->second.health.state == CLOSED) &&
+                 candidate->second.lastSeen < victim->second.lastSeen)) {
+                victim = candidate;
+            }
+            ++candidate;
+        }
+        if (origins.size() >= maxOrigins) {
+            origins.erase(victim);
+        }
+    }
+    Origin& origin = origins[key];
+    origin.lastSeen = now;
+    return origin;
+}
+
+// Caller must hold healthMutex
+void HealthTracker::tripLocked(Origin& origin, Clock::time_point now) {
+    origin.health.state = OPEN;
+    origin.openedAt = now;
+    origin.probing = false;
+    ++origin.trips;
+    ++stats.trips;
+}
+
+// Open time doubles with every consecutive trip, up to maxOpenDuration
+std::chrono::seconds HealthTracker::openTimeLocked(const Origin& origin) const {
+    std::chrono::seconds open = openDuration;
+    for (unsigned i = 1; i < origin.trips && open < maxOpenDuration; ++i) {
+        open *= 2;
+    }
+    return std::min(open, maxOpenDuration);
+}
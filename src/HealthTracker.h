@@ -0,0 +1,78 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Per-origin health (consecutive failures, latency and error rate as moving averages)
+ * with a circuit breaker. An origin that keeps failing is cut off for openDuration, then
+ * a single probe request decides whether it is healthy again.
+ */
+class HealthTracker {
+public:
+    enum State {
+        CLOSED,     // normal operation
+        OPEN,       // failing, requests are refused without touching the origin
+        HALF_OPEN   // one probe request is allowed through
+    };
+
+    struct Stats {
+        size_t origins;
+        size_t openCircuits;
+        uint64_t trips;      // times a circuit opened
+        uint64_t rejected;   // requests refused by an open circuit
+        uint64_t probes;
+    };
+
+    struct OriginHealth {
+        State state;
+        unsigned consecutiveFailures;
+        double latencyMs;    // EWMA of time to first response byte
+        double errorRate;    // EWMA of failed exchanges, 0..1
+        uint64_t samples;
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    struct Origin {
+        OriginHealth health;
+        Clock::time_point openedAt;
+        Clock::time_point probeStarted;
+        bool probing;
+        unsigned trips;      // consecutive trips, doubles the open time
+        std::vector<uint32_t> recentLatency;  // ring of the latest latency samples in microseconds
+        size_t nextSample;
+        Clock::time_point lastSeen;           // last success or failure recorded
+    };
+
+    std::unordered_map<std::string, Origin> origins;
+    std::mutex healthMutex;
+    unsigned failureThreshold;
+    double errorRateThreshold;
+    uint64_t minSamples;
+    std::chrono::seconds openDuration;
+    std::chrono::seconds maxOpenDuration;
+    size_t maxOrigins;
+    Stats stats;
+
+    Origin& originLocked(const std::string& key, Clock::time_point now);
+    void tripLocked(Origin& origin, Clock::time_point now);
+    std::chrono::seconds openTimeLocked(const Origin& origin) const;
+
+public:
+    HealthTracker(unsigned failureThreshold = 5, double errorRateThreshold = 0.5, uint64_t minSamples = 20,
+                  std::chrono::seconds openDuration = std::chrono::seconds(5),
+                  std::chrono::seconds maxOpenDuration = std::chrono::seconds(60), size_t maxOrigins = 10000);
+
+    bool allow(const std::string& host, const std::string& port);
+    bool healthy(const std::string& host, const std::string& port);
+    void recordSuccess(const std::string& host, const std::string& port, std::chrono::microseconds latency);
+    void recordFailure(const std::string& host, const std::string& port);
+    bool getOrigin(const std::string& host, const std::string& port, OriginHealth& health);
+    bool latencyPercentile(const std::string& host, const std::string& port, double quantile,
+                           std::chrono::microseconds& latency);
+    Stats getStats();
+};
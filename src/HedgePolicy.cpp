@@ -0,0 +1,57 @@
+#include "HedgePolicy.h"
+#include <algorithm>
+
+// Never hedge sooner than this, even for very fast origins
+#define MIN_HEDGE_DELAY_MS 5
+
+HedgePolicy::HedgePolicy(const HedgeConfig& config, std::shared_ptr<HealthTracker> health)
+    : config(config), health(health), tokens(config.maxBurst), stats() {}
+
+/**
+ * @brief: How long to wait for the first response before hedging a GET to host:port.
+ *         False when hedging is off or the origin has too little latency history.
+ *         Every call earns budget for later hedges.
+ */
+bool HedgePolicy::thresholdFor(const std::string& host, const std::string& port, std::chrono::milliseconds& delay) {
+    if (!config.enabled) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(hedgeMutex);
+        ++stats.eligible;
+        tokens = std::min(config.maxBurst, tokens + config.budget);
+    }
+    if (config.delay.count() > 0) {
+        delay = config.delay;
+        return true;
+    }
+    std::chrono::microseconds latency;
+    if (!health || !health->latencyPercentile(host, port, config.percentile, latency)) {
+        return false;
+    }
+    delay = std::max(std::chrono::milliseconds(MIN_HEDGE_DELAY_MS),
+                     std::chrono::duration_cast<std::chrono::milliseconds>(latency));
+    return true;
+}
+
+// Take one hedge from the budget
+bool HedgePolicy::tryHedge() {
+    std::lock_guard<std::mutex> lock(hedgeMutex);
+    if (tokens < 1) {
+        ++stats.denied;
+        return false;
+    }
+    tokens -= 1;
+    ++stats.hedged;
+    return true;
+}
+
+void HedgePolicy::recordWin() {
+    std::lock_guard<std::mutex> lock(hedgeMutex);
+    ++stats.wins;
+}
+
+HedgePolicy::Stats HedgePolicy::getStats() {
+    std::lock_guard<std::mutex> lock(hedgeMutex);
+    return stats;
+}
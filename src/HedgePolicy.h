@@ -0,0 +1,49 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include "HealthTracker.h"
+
+// Opt-in settings for hedged GETs
+struct HedgeConfig {
+    bool enabled;
+    std::chrono::milliseconds delay;   // fixed threshold, zero to derive it from latency percentiles
+    double percentile;                 // origin latency quantile used when delay is zero
+    double budget;                     // hedges allowed per eligible request, e.g. 0.05 for 5%
+    double maxBurst;                   // unused budget that can be saved up
+
+    HedgeConfig()
+        : enabled(false), delay(0), percentile(0.95), budget(0.05), maxBurst(10) {}
+};
+
+/**
+ * Decides when a slow GET gets a duplicate on a second connection. The threshold is fixed
+ * or the origin's recent latency at a percentile. A token bucket filled by every eligible
+ * request and drained by every hedge keeps the extra upstream load within budget.
+ */
+class HedgePolicy {
+public:
+    struct Stats {
+        uint64_t eligible;   // GETs that could have been hedged
+        uint64_t hedged;     // duplicates sent
+        uint64_t wins;       // duplicates that answered first
+        uint64_t denied;     // hedges skipped for lack of budget
+    };
+
+private:
+    HedgeConfig config;
+    std::shared_ptr<HealthTracker> health;
+    std::mutex hedgeMutex;
+    double tokens;
+    Stats stats;
+
+public:
+    HedgePolicy(const HedgeConfig& config, std::shared_ptr<HealthTracker> health);
+
+    bool thresholdFor(const std::string& host, const std::string& port, std::chrono::milliseconds& delay);
+    bool tryHedge();
+    void recordWin();
+    Stats getStats();
+};
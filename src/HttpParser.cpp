@@ -1,6 +1,8 @@
 #include "HttpParser.h"
 #include <sstream>
 #include <iostream>
+#include <cstring>
+#include <strings.h>
 
 HttpParser::HttpParser() {}
 
@@ -34,7 +36,7 @@ HttpRequest HttpParser::parseRequest(const std::string& rawRequest) {
             if (!value.empty() && value.back() == '\r') {
                 value.pop_back();
             }
-            if (key == "Host") {
+            if (HeaderMap::lookup(key) == HeaderMap::HOST) {
                 size_t portPos = value.find(':');
                 if (portPos != std::string::npos) {
                     // If port is specified, extract hostname and port
@@ -49,16 +51,15 @@ HttpRequest HttpParser::parseRequest(const std::string& rawRequest) {
                     }
                 }       
             }
-            request.headers[key] = value;
+            request.headers.set(key, value);
         }
     }
 
-    // Parse body if present
-    std::stringstream bodyStream;
-    while (std::getline(stream, line)) {
-        bodyStream << line << "\n";
+    // Body bytes that arrived together with the head, kept byte for byte
+    size_t headEnd = rawRequest.find("\r\n\r\n");
+    if (headEnd != std::string::npos) {
+        request.body = rawRequest.substr(headEnd + 4);
     }
-    request.body = bodyStream.str();
     return request;
 }
 
@@ -67,9 +68,9 @@ std::string HttpParser::buildRequest(const HttpRequest& request) {
     
     ss << request.method << " " << request.url << " " << request.version << "\r\n";
     
-    for (const auto& header : request.headers) {
-        ss << header.first << ": " << header.second << "\r\n";
-    }
+    request.headers.forEach([&ss](HeaderMap::Id, const HeaderMap::Field& field) {
+        ss << field.name << ": " << field.value << "\r\n";
+    });
     
     ss << "\r\n" << request.body;
     return ss.str();
@@ -81,9 +82,9 @@ bool HttpParser::isValidRequest(const HttpRequest& request) {
         return false;
     }
     
-    // Validate method
-    if (request.method != "GET" && request.method != "POST" && 
-        request.method != "CONNECT") {
+    // Any method is forwarded, but it has to be a token (RFC 7230 section 3.2.6)
+    if (request.method.find_first_not_of("!#$%&'*+-.^_`|~0123456789"
+                                         "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz") != std::string::npos) {
         return false;
     }
     
@@ -93,4 +94,27 @@ bool HttpParser::isValidRequest(const HttpRequest& request) {
     }
     
     return true;
-} 
\ No newline at end of file
+} 
+
+/**
+ * @brief: Value of a header in a raw header block (status or request line first),
+ *         matching the name case-insensitively. Empty if the header is absent.
+ */
+std::string HttpParser::findHeader(const std::string& headerBlock, const char* name) {
+    size_t nameLen = strlen(name);
+    size_t lineStart = headerBlock.find("\r\n");
+    while (lineStart != std::string::npos) {
+        lineStart += 2;
+        size_t lineEnd = headerBlock.find("\r\n", lineStart);
+        if (lineEnd == std::string::npos || lineEnd == lineStart) {
+            break;
+        }
+        if (lineEnd - lineStart > nameLen && headerBlock[lineStart + nameLen] == ':' &&
+            strncasecmp(headerBlock.c_str() + lineStart, name, nameLen) == 0) {
+            size_t valueStart = headerBlock.find_first_not_of(' ', lineStart + nameLen + 1);
+            return valueStart >= lineEnd ? "" : headerBlock.substr(valueStart, lineEnd - valueStart);
+        }
+        lineStart = lineEnd;
+    }
+    return "";
+}
\ No newline at end of file
@@ -1,17 +1,20 @@
 #pragma once
 #include <string>
-#include <unordered_map>
+#include "HeaderMap.h"
+#include "RequestTrace.h"
 
 struct HttpRequest {
     std::string method;
     std::string request;
     std::string url;
     std::string version;
-    std::unordered_map<std::string, std::string> headers;
-    std::string body;
+    HeaderMap headers;
+    std::string body;          // body bytes read along with the head
+    std::string remainder;     // bytes read past the end of the body, the start of the next request
     std::string raw;
     std::string host;
     std::string port;
+    RequestTrace trace;        // filled in while the request is answered, for the access log
 };
 
 class HttpParser {
@@ -20,4 +23,5 @@ public:
     HttpRequest parseRequest(const std::string& rawRequest);
     std::string buildRequest(const HttpRequest& request);
     bool isValidRequest(const HttpRequest& request);
+    static std::string findHeader(const std::string& headerBlock, const char* name);
 }; 
\ No newline at end of file
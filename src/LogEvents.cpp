@@ -0,0 +1,65 @@
+#include "LogEvents.h"
+
+static const LogEventInfo events[EVENT_COUNT] = {
+    {"message", "%0", 1, 0, {"message"}},
+    {"connection", "from %0", 1, 0, {"address"}},
+    {"request", "Requesting \"%0\" from %1", 2, 0, {"request", "host"}},
+    {"cached", "cached, expires in %0s", 1, 0, {"max_age"}},
+    {"completed", "Completed forwarding %0 request", 1, 0, {"method"}},
+    {"access", "%0 %1 %3 %2 in=%4 out=%5 reused=%6 parse=%7us dns=%8us connect=%9us ttfb=%10us transfer=%11us", 3, 9,
+     {"method", "url", "cache", "status", "bytes_in", "bytes_out", "reused", "parse_us", "dns_us", "connect_us",
+      "ttfb_us", "transfer_us"}},
+};
+
+/**
+ * @brief: Describe an event type, nullptr for types this build does not know
+ */
+const LogEventInfo* logEventInfo(uint8_t type) {
+    return type < EVENT_COUNT ? &events[type] : nullptr;
+}
+
+const char* logLevelName(uint8_t level) {
+    static const char* names[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+    return level < 4 ? names[level] : "UNKNOWN";
+}
+
+/**
+ * @brief: Append the text log line of a record: "id: text time" for a client's records,
+ *         "No clientID: [LEVEL] text time" for the others
+ */
+void renderLogLine(std::string& out, uint8_t type, uint8_t level, int clientId, const std::string_view* fields,
+                   size_t fieldCount, const uint64_t* numbers, size_t numberCount, const char* timeText) {
+    if (clientId != LOG_NO_CLIENT) {
+        out += std::to_string(clientId);
+        out += ": ";
+    } else {
+        out += "No clientID: [";
+        out += logLevelName(level);
+        out += "] ";
+    }
+    const LogEventInfo* info = logEventInfo(type);
+    if (info == nullptr) {
+        out += "unknown event " + std::to_string(type);
+    } else {
+        for (const char* c = info->textTemplate; *c != '\0'; ++c) {
+            if (c[0] != '%' || c[1] < '0' || c[1] > '9') {
+                out += *c;
+                continue;
+            }
+            size_t index = 0;
+            while (c[1] >= '0' && c[1] <= '9') {
+                index = index * 10 + (*++c - '0');
+            }
+            if (index < info->fieldCount) {
+                if (index < fieldCount) {
+                    out.append(fields[index].data(), fields[index].size());
+                }
+            } else if (index - info->fieldCount < numberCount) {
+                out += std::to_string(numbers[index - info->fieldCount]);
+            }
+        }
+    }
+    out += ' ';
+    out += timeText;
+    out += '\n';
+}
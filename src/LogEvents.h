@@ -0,0 +1,54 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+
+// String and numeric fields an event carries at most
+#define LOG_MAX_FIELDS 3
+#define LOG_MAX_NUMBERS 10
+// Client id of records that belong to no client
+#define LOG_NO_CLIENT -1
+
+/*
+Binary log layout. A file starts with LOG_MAGIC, then records follow back to back, each a
+LOG_HEADER_SIZE header and a payload. Integers are little-endian.
+  header:  u8 type, u8 level, u16 payload length, i32 client id, i64 time in microseconds
+  payload: one varint per string field. An odd value v refers to interned string v >> 1, an
+           even value v is followed by v >> 1 bytes of the field itself. Numeric fields follow,
+           one varint each
+A record of type LOG_STRING_DEFINITION interns a string instead: its payload is the varint
+id followed by the bytes. A definition always comes before the first use of its id and
+replaces an earlier string with that id, so logs appended by several runs stay readable.
+*/
+#define LOG_MAGIC "PXYLOG1\n"
+#define LOG_MAGIC_SIZE 8
+#define LOG_HEADER_SIZE 16
+#define LOG_STRING_DEFINITION 0xFF
+
+/**
+ * Kinds of log records. Each has a fixed list of string fields and a template for its
+ * text line, so the text log, the binary log and logdump agree on what a record says.
+ */
+enum LogEvent : uint8_t {
+    EVENT_MESSAGE,      // free text
+    EVENT_CONNECTION,   // client connected
+    EVENT_REQUEST,      // request about to be forwarded
+    EVENT_CACHED,       // response stored in the cache
+    EVENT_COMPLETED,    // forwarding finished
+    EVENT_ACCESS,       // one request answered, with its outcome and phase timings
+    EVENT_COUNT
+};
+
+struct LogEventInfo {
+    const char* name;
+    const char* textTemplate;   // %0, %1, ... stand for the string fields, then the numbers
+    size_t fieldCount;
+    size_t numberCount;
+    const char* fieldNames[LOG_MAX_FIELDS + LOG_MAX_NUMBERS];
+};
+
+const LogEventInfo* logEventInfo(uint8_t type);
+const char* logLevelName(uint8_t level);
+void renderLogLine(std::string& out, uint8_t type, uint8_t level, int clientId, const std::string_view* fields,
+                   size_t fieldCount, const uint64_t* numbers, size_t numberCount, const char* timeText);
@@ -1,46 +1,301 @@
 #include "Logger.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <cerrno>
+#include <cstring>
 #include <ctime>
-#include <iomanip>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
 
-Logger::Logger(const std::string& logPath) : logPath(logPath) {
-    logFile.open(logPath, std::ios::app);
-    if (!logFile.is_open()) {
+// How long the flusher sleeps when the ring is empty
+#define LOG_FLUSH_INTERVAL_MS 50
+// Formatted bytes collected before a write
+#define LOG_BATCH_SIZE 65536
+// Binary log: longest field worth interning and the most strings interned
+#define LOG_INTERN_MAX_LENGTH 128
+#define LOG_INTERN_LIMIT 65536
+
+static void appendVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+static void appendLittleEndian(std::string& out, uint64_t value, size_t bytes) {
+    for (size_t i = 0; i < bytes; ++i) {
+        out += static_cast<char>((value >> (8 * i)) & 0xFF);
+    }
+}
+
+Logger::Logger(const std::string& logPath, Format format)
+    : logPath(logPath), format(format), ring(new Record[LOG_RING_SIZE]), enqueuePos(0), dequeuePos(0), written(0),
+      dropped(0), internedCount(0), stopping(false), formattedSecond(-1), droppedReported(0) {
+    logFd = open(logPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (logFd < 0) {
         throw std::runtime_error("Failed to open log file: " + logPath);
     }
+    struct stat info;
+    if (format == BINARY && fstat(logFd, &info) == 0 && info.st_size == 0) {
+        batch.assign(LOG_MAGIC, LOG_MAGIC_SIZE);
+        writeBatch();
+    }
+    for (uint64_t i = 0; i < LOG_RING_SIZE; ++i) {
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    batch.reserve(LOG_BATCH_SIZE + 2 * LOG_MESSAGE_SIZE + 64);
+    flusher = std::thread(&Logger::run, this);
 }
 
 Logger::~Logger() {
-    if (logFile.is_open()) {
-        logFile.close();
-    }
+    stopping = true;
+    wakeup.notify_one();
+    flusher.join();
+    close(logFd);
 }
 
 void Logger::log(LogLevel level, const std::string& message) {
-    std::lock_guard<std::mutex> lock(logMutex);
-    
-    auto now = std::time(nullptr);
-    auto tm = *std::localtime(&now);
-    
-    const char* levelStr;
-    switch (level) {
-        case DEBUG: levelStr = "DEBUG"; break;
-        case INFO: levelStr = "INFO"; break;
-        case WARNING: levelStr = "WARNING"; break;
-        case ERROR: levelStr = "ERROR"; break;
-        default: levelStr = "UNKNOWN";
-    }
-    
-    logFile << "No clientID"
-            << ": [" << levelStr << "] " 
-            << message << std::put_time(&tm, "%Y-%m-%d %H:%M:%S") <<std::endl;
+    std::string_view field(message);
+    push(EVENT_MESSAGE, level, LOG_NO_CLIENT, &field, 1);
 }
 
 void Logger::log(const std::string& message, int clientId) {
-    std::lock_guard<std::mutex> lock(logMutex);
-    auto now = std::time(nullptr);
-    auto tm = *std::localtime(&now);
-    
-    logFile << clientId << ": "
-            << message << " " << std::put_time(&tm, "%Y-%m-%d %H:%M:%S") << std::endl;
+    std::string_view field(message);
+    push(EVENT_MESSAGE, INFO, clientId, &field, 1);
+}
+
+/**
+ * @brief: Log a structured event of a client, with the fields its type declares
+ */
+void Logger::event(LogEvent type, int clientId, std::string_view first, std::string_view second,
+                   std::string_view third) {
+    std::string_view fields[LOG_MAX_FIELDS] = {first, second, third};
+    push(type, INFO, clientId, fields, logEventInfo(type)->fieldCount);
+}
+
+/**
+ * @brief: Log the access entry of an answered request, stamped with the time it arrived
+ */
+void Logger::access(int clientId, const std::string& method, const std::string& url, const RequestTrace& trace) {
+    std::string_view fields[LOG_MAX_FIELDS] = {method, url, RequestTrace::cacheStatusName(trace.cache)};
+    uint64_t numbers[] = {
+        static_cast<uint64_t>(trace.status), trace.bytesIn, trace.bytesOut, trace.upstreamReused ? 1u : 0u,
+        trace.parseMicros, trace.dnsMicros, trace.connectMicros, trace.ttfbMicros, trace.transferMicros
+    };
+    push(EVENT_ACCESS, INFO, clientId, fields, LOG_MAX_FIELDS, numbers, sizeof(numbers) / sizeof(numbers[0]),
+         RequestTrace::wallMicros(trace.start));
+}
+
+/**
+ * @brief: Claim the next ring slot and copy the fields into it, without locks or
+ *         allocation. A full ring drops the record rather than blocking the request.
+ *         A zero time stamps the record with the coarse wall clock.
+ */
+void Logger::push(LogEvent type, LogLevel level, int clientId, const std::string_view* fields, size_t fieldCount,
+                  const uint64_t* numbers, size_t numberCount, int64_t time) {
+    uint64_t pos = enqueuePos.load(std::memory_order_relaxed);
+    Record* record;
+    while (true) {
+        record = &ring[pos & (LOG_RING_SIZE - 1)];
+        uint64_t sequence = record->sequence.load(std::memory_order_acquire);
+        int64_t lag = static_cast<int64_t>(sequence - pos);
+        if (lag == 0) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (lag < 0) {
+            // The flusher has not read this slot's previous record yet
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+    if (time == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME_COARSE, &now);
+        time = static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+    }
+    record->time = time;
+    record->clientId = clientId;
+    record->type = type;
+    record->level = static_cast<uint8_t>(level);
+    record->fieldCount = static_cast<uint8_t>(std::min<size_t>(fieldCount, LOG_MAX_FIELDS));
+    size_t used = 0;
+    for (size_t i = 0; i < record->fieldCount; ++i) {
+        size_t length = std::min<size_t>(fields[i].size(), LOG_MESSAGE_SIZE - used);
+        memcpy(record->text + used, fields[i].data(), length);
+        record->lengths[i] = static_cast<uint16_t>(length);
+        used += length;
+    }
+    record->numberCount = static_cast<uint8_t>(std::min<size_t>(numberCount, LOG_MAX_NUMBERS));
+    std::copy(numbers, numbers + record->numberCount, record->numbers);
+    record->sequence.store(pos + 1, std::memory_order_release);
+    // In a burst the flusher must not sleep out its interval while the ring fills up
+    if ((pos & (LOG_RING_SIZE / 4 - 1)) == 0) {
+        wakeup.notify_one();
+    }
+}
+
+/**
+ * @brief: Block until everything logged before the call is in the file, or a second passed
+ */
+void Logger::flush() {
+    uint64_t target = enqueuePos.load(std::memory_order_acquire);
+    wakeup.notify_one();
+    for (int waited = 0; waited < 1000 && dequeuePos.load(std::memory_order_acquire) < target; ++waited) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
 }
 
+Logger::Stats Logger::getStats() const {
+    Stats stats;
+    stats.written = written.load(std::memory_order_relaxed);
+    stats.dropped = dropped.load(std::memory_order_relaxed);
+    stats.interned = internedCount.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void Logger::run() {
+    while (true) {
+        bool finishing = stopping.load();
+        bool drained = drain();
+        if (finishing && !drained) {
+            break;
+        }
+        if (!drained) {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wakeup.wait_for(lock, std::chrono::milliseconds(LOG_FLUSH_INTERVAL_MS));
+        }
+    }
+}
+
+/**
+ * @brief: Format every published record into the batch and write it out. Returns false
+ *         when there was nothing to read.
+ */
+bool Logger::drain() {
+    uint64_t pos = dequeuePos.load(std::memory_order_relaxed);
+    uint64_t start = pos;
+    std::string_view fields[LOG_MAX_FIELDS];
+    while (true) {
+        Record& record = ring[pos & (LOG_RING_SIZE - 1)];
+        if (record.sequence.load(std::memory_order_acquire) != pos + 1) {
+            break;
+        }
+        size_t offset = 0;
+        for (size_t i = 0; i < record.fieldCount; ++i) {
+            fields[i] = std::string_view(record.text + offset, record.lengths[i]);
+            offset += record.lengths[i];
+        }
+        appendRecord(record.type, record.level, record.clientId, record.time, fields, record.fieldCount,
+                     record.numbers, record.numberCount);
+        record.sequence.store(pos + LOG_RING_SIZE, std::memory_order_release);
+        ++pos;
+        if (batch.size() >= LOG_BATCH_SIZE) {
+            writeBatch();
+        }
+    }
+    uint64_t lost = dropped.load(std::memory_order_relaxed);
+    if (lost != droppedReported) {
+        std::string warning = std::to_string(lost - droppedReported) + " log records dropped, the log ring was full";
+        fields[0] = warning;
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME_COARSE, &now);
+        appendRecord(EVENT_MESSAGE, WARNING, LOG_NO_CLIENT,
+                     static_cast<int64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000, fields, 1, nullptr, 0);
+        droppedReported = lost;
+    }
+    writeBatch();
+    written.fetch_add(pos - start, std::memory_order_relaxed);
+    dequeuePos.store(pos, std::memory_order_release);
+    return pos != start;
+}
+
+void Logger::appendRecord(uint8_t type, uint8_t level, int clientId, int64_t time, const std::string_view* fields,
+                          size_t fieldCount, const uint64_t* numbers, size_t numberCount) {
+    if (format == TEXT) {
+        // localtime is costly, records of the same second share the text
+        int64_t second = time / 1000000;
+        if (second != formattedSecond) {
+            time_t clock = static_cast<time_t>(second);
+            struct tm tm;
+            localtime_r(&clock, &tm);
+            strftime(timeText, sizeof(timeText), "%Y-%m-%d %H:%M:%S", &tm);
+            formattedSecond = second;
+        }
+        renderLogLine(batch, type, level, clientId, fields, fieldCount, numbers, numberCount, timeText);
+        return;
+    }
+    payload.clear();
+    for (size_t i = 0; i < fieldCount; ++i) {
+        uint32_t id = intern(fields[i], time);
+        if (id != UINT32_MAX) {
+            appendVarint(payload, (static_cast<uint64_t>(id) << 1) | 1);
+        } else {
+            appendVarint(payload, static_cast<uint64_t>(fields[i].size()) << 1);
+            payload.append(fields[i].data(), fields[i].size());
+        }
+    }
+    for (size_t i = 0; i < numberCount; ++i) {
+        appendVarint(payload, numbers[i]);
+    }
+    appendHeader(type, level, clientId, time, payload.size());
+    batch += payload;
+}
+
+void Logger::appendHeader(uint8_t type, uint8_t level, int clientId, int64_t time, size_t payloadLength) {
+    batch += static_cast<char>(type);
+    batch += static_cast<char>(level);
+    appendLittleEndian(batch, payloadLength, 2);
+    appendLittleEndian(batch, static_cast<uint32_t>(clientId), 4);
+    appendLittleEndian(batch, static_cast<uint64_t>(time), 8);
+}
+
+/**
+ * @brief: Id of a field in the binary log's string table, defining it in the batch when a
+ *         short field shows up for the second time. UINT32_MAX means write it inline.
+ */
+uint32_t Logger::intern(std::string_view field, int64_t time) {
+    if (field.size() > LOG_INTERN_MAX_LENGTH) {
+        return UINT32_MAX;
+    }
+    auto known = interned.find(std::string(field));
+    if (known != interned.end()) {
+        return known->second;
+    }
+    // One-off values such as most URLs would only fill the table
+    if (interned.size() >= LOG_INTERN_LIMIT || seenOnce.insert(std::hash<std::string_view>()(field)).second) {
+        if (seenOnce.size() >= LOG_INTERN_LIMIT) {
+            seenOnce.clear();
+        }
+        return UINT32_MAX;
+    }
+    uint32_t id = static_cast<uint32_t>(interned.size());
+    interned.emplace(std::string(field), id);
+    internedCount.store(interned.size(), std::memory_order_relaxed);
+    std::string definition;
+    appendVarint(definition, id);
+    definition.append(field.data(), field.size());
+    appendHeader(LOG_STRING_DEFINITION, 0, LOG_NO_CLIENT, time, definition.size());
+    batch += definition;
+    return id;
+}
+
+void Logger::writeBatch() {
+    size_t offset = 0;
+    while (offset < batch.size()) {
+        ssize_t count = write(logFd, batch.data() + offset, batch.size() - offset);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            break;   // nowhere to report it, the lines are lost
+        }
+        offset += count;
+    }
+    batch.clear();
+}
@@ -1,15 +1,30 @@
 #pragma once
 #include <string>
-#include <fstream>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <thread>
 #include <mutex>
-#include <string>
+#include <condition_variable>
+#include <memory>
+#include <cstdint>
+#include "LogEvents.h"
+#include "RequestTrace.h"
 
-class Logger {
-private:
-    std::ofstream logFile;
-    std::mutex logMutex;
-    std::string logPath;
+// Records in the ring, a power of two
+#define LOG_RING_SIZE 8192
+// Field bytes kept per record, longer fields are cut
+#define LOG_MESSAGE_SIZE 480
 
+/**
+ * Asynchronous logger. Request threads copy each record into a fixed-size slot of a
+ * lock-free bounded MPSC ring and return; one background thread formats the records and
+ * appends them to the file in large batches, as text lines or in the binary format of
+ * LogEvents.h. When the ring is full the new record is dropped and counted instead of
+ * making the caller wait.
+ */
+class Logger {
 public:
     enum LogLevel {
         DEBUG,
@@ -18,9 +33,75 @@ public:
         ERROR
     };
 
-    Logger(const std::string& logPath);
+    enum Format {
+        TEXT,
+        BINARY
+    };
+
+    struct Stats {
+        uint64_t written;   // records formatted into the file
+        uint64_t dropped;   // records lost because the ring was full
+        size_t interned;    // strings in the binary log's table
+    };
+
+private:
+    // One ring slot. sequence tells whose turn the slot is: equal to the enqueue position
+    // when a producer may fill it, one past it once the record can be read
+    struct Record {
+        std::atomic<uint64_t> sequence;
+        int64_t time;   // microseconds since the epoch
+        int clientId;
+        uint8_t type;
+        uint8_t level;
+        uint8_t fieldCount;
+        uint8_t numberCount;
+        uint16_t lengths[LOG_MAX_FIELDS];
+        uint64_t numbers[LOG_MAX_NUMBERS];
+        char text[LOG_MESSAGE_SIZE];
+    };
+
+    int logFd;
+    std::string logPath;
+    Format format;
+    std::unique_ptr<Record[]> ring;
+    alignas(64) std::atomic<uint64_t> enqueuePos;
+    alignas(64) std::atomic<uint64_t> dequeuePos;   // written by the flusher only
+    std::atomic<uint64_t> written;
+    std::atomic<uint64_t> dropped;
+    std::atomic<size_t> internedCount;
+    std::atomic<bool> stopping;
+    std::mutex wakeMutex;
+    std::condition_variable wakeup;
+
+    // Used by the flusher thread only
+    std::string batch;
+    std::string payload;
+    int64_t formattedSecond;
+    char timeText[32];
+    uint64_t droppedReported;
+    std::unordered_map<std::string, uint32_t> interned;
+    std::unordered_set<size_t> seenOnce;   // hashes of fields met once, interned when met again
+    std::thread flusher;
+
+    void push(LogEvent type, LogLevel level, int clientId, const std::string_view* fields, size_t fieldCount,
+              const uint64_t* numbers = nullptr, size_t numberCount = 0, int64_t time = 0);
+    void run();
+    bool drain();
+    void appendRecord(uint8_t type, uint8_t level, int clientId, int64_t time, const std::string_view* fields,
+                      size_t fieldCount, const uint64_t* numbers, size_t numberCount);
+    void appendHeader(uint8_t type, uint8_t level, int clientId, int64_t time, size_t payloadLength);
+    uint32_t intern(std::string_view field, int64_t time);
+    void writeBatch();
+
+public:
+    Logger(const std::string& logPath, Format format = TEXT);
     ~Logger();
-    
+
     void log(LogLevel level, const std::string& message);
     void log(const std::string& message, int clientId);
-}; 
\ No newline at end of file
+    void event(LogEvent type, int clientId, std::string_view first, std::string_view second = std::string_view(),
+               std::string_view third = std::string_view());
+    void access(int clientId, const std::string& method, const std::string& url, const RequestTrace& trace);
+    void flush();
+    Stats getStats() const;
+};
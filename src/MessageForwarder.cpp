@@ -5,252 +5,809 @@
 #include <unistd.h>
 #include <iostream>
 #include <algorithm>
+#include <cstring>
+#include <strings.h>
+#include <chrono>
+#include <poll.h>
+#include <sstream>
 
-void MessageForwarder::forwardGet(HttpRequest& req, int clientSocket, int clientId, std::shared_ptr<Logger> logger) {
-    // Log the request before forwarding
-    logger->log("Requesting \"" + req.request + " from " + req.host, clientId);
-    // Connect to the target server
-    int serverSocket = connectToServer(req.host, req.port);
-    if (serverSocket < 0) {
-        logger->log(Logger::LogLevel::ERROR, "Failed to connect to server: " + req.host + ":" + req.port);
-        sendErrorResponse(clientSocket, 502, "Bad Gateway");
-        return;
+// Largest interim response head looked at while waiting for 100 Continue
+#define MAX_INTERIM_HEAD 4096
+
+MessageForwarder::MessageForwarder(std::shared_ptr<NegativeCache> negativeCache, std::shared_ptr<ConnectionPool> pool,
+                                   std::shared_ptr<Dialer> dialer, std::shared_ptr<Preconnector> preconnector,
+                                   std::shared_ptr<HealthTracker> health, std::shared_ptr<TimerService> timers,
+                                   std::shared_ptr<HedgePolicy> hedging, std::shared_ptr<OriginLimiter> limiter,
+                                   const UploadPolicy& uploads)
+    : negativeCache(negativeCache), pool(pool), dialer(dialer), preconnector(preconnector), health(health), timers(timers),
+      hedging(hedging), limiter(limiter), uploads(uploads), retries(0), continued(0), continuedLocally(0),
+      refusedUploads(0) {
+    if (!this->timers) {
+        this->timers = std::make_shared<TimerService>();
     }
-    
-    // Forward the request to the server
-    std::string requestToSend = buildForwardRequest(req);
-    if (send(serverSocket, requestToSend.c_str(), requestToSend.length(), 0) < 0) {
-        logger->log(Logger::LogLevel::ERROR, "Failed to send request to server");
-        close(serverSocket);
-        sendErrorResponse(clientSocket, 500, "Internal Server Error");
-        return;
+    if (!this->dialer) {
+        this->dialer = std::make_shared<Dialer>(std::make_shared<DnsResolver>(), std::chrono::milliseconds(250),
+                                                this->timers->phases().connect);
     }
-    
-    // Read and forward the response from the server to the client
-    bool keepAliveServer = false;
-    bool keepAliveClient = false;
-    
-    // Check if client requested keep-alive
-    auto clientConnectionIt = req.headers.find("Connection");
-    if (clientConnectionIt != req.headers.end() && 
-        strcasecmp(clientConnectionIt->second.c_str(), "keep-alive") == 0) {
-        keepAliveClient = true;
+}
+
+/*
+@brief: Forward a request of any method but CONNECT and stream the response back. A request
+        body is streamed through as it arrives. Bodiless requests can be sent again, so they
+        are retried on a fresh connection when a pooled one turns out closed, and GETs may be
+        hedged. Bytes the client sent past the request end up in req.remainder.
+        A body announced with Expect: 100-continue is only read once the origin, or the
+        proxy under a local policy, asked for it; an upload answered before that is never
+        transferred. When captured is set, the complete response is also copied into it for
+        the cache, unless it grows past captureLimit. When parsed is set, it receives the
+        response parser. Returns false when the client stream is no longer at a request
+        boundary, either after an error or because a refused body was left unread.
+*/
+bool MessageForwarder::forwardRequest(HttpRequest& req, int clientSocket, int clientId, std::shared_ptr<Logger> logger,
+                                      std::string* captured, size_t captureLimit, ResponseFramer* parsed) {
+    if (req.port.empty()) {
+        req.port = "80";
     }
     
-    // Buffer for receiving data
-    char buffer[BUFFER_SIZE];
-    ssize_t bytesRead;
-    std::string responseHeaders;
-    bool headersComplete = false;
-    size_t contentLength = 0;
-    size_t receivedBodyBytes = 0;
-    bool chunkedEncoding = false;
+    // Work out how the body is delimited before involving the origin
+    ResponseFramer body;
+    body.frameRequest(req.raw.substr(0, req.raw.size() - req.body.size()));
+    if (body.error()) {
+        logger->log(Logger::LogLevel::ERROR, req.method + " request with invalid Content-Length or Transfer-Encoding");
+        sendErrorResponse(clientSocket, 400, "Bad Request", &req.trace);
+        return false;
+    }
+    bool expectContinue = !body.complete() && expectsContinue(req);
+    if (uploads.maxBodySize > 0 && body.mode() == ResponseFramer::CONTENT_LENGTH &&
+        body.bytesRemaining() > uploads.maxBodySize) {
+        ++refusedUploads;
+        logger->log(Logger::LogLevel::WARNING, req.method + " body of " + std::to_string(body.bytesRemaining()) +
+                    " bytes is over the upload limit for " + req.url);
+        sendErrorResponse(clientSocket, 413, "Payload Too Large", &req.trace);
+        return false;
+    }
+    if (uploads.answerLocally) {
+        // The proxy takes the body either way, the origin need not be asked
+        req.headers.erase(HeaderMap::EXPECT);
+    }
+    RequestHead head;
+    if (!buildForwardRequest(req, head, body.mode() == ResponseFramer::CHUNKED)) {
+        logger->log(Logger::LogLevel::ERROR, "Too many request headers to forward " + req.url);
+        sendErrorResponse(clientSocket, 431, "Request Header Fields Too Large", &req.trace);
+        return false;
+    }
+    OriginLimiter::Slot slot(limiter, req.host, req.port, timers->phases().originQueue);
+    if (!slot.admitted()) {
+        logger->log(Logger::LogLevel::WARNING, "Too many requests in flight to " + req.host + ":" + req.port);
+        sendErrorResponse(clientSocket, 503, "Service Unavailable", &req.trace);
+        return false;
+    }
     
-    // Read and process the response
-    while ((bytesRead = recv(serverSocket, buffer, BUFFER_SIZE - 1, 0)) > 0) {
-        buffer[bytesRead] = '\0';  // Null-terminate for string operations
-        
-        // If we haven't finished reading headers yet
-        if (!headersComplete) {
-            responseHeaders.append(buffer, bytesRead);
-            
-            // Check if we've received all headers
-            size_t headerEnd = responseHeaders.find("\r\n\r\n");
-            if (headerEnd != std::string::npos) {
-                headersComplete = true;
-                
-                // Extract headers to check for keep-alive and content length
-                std::string headerSection = responseHeaders.substr(0, headerEnd);
-                
-                // Check if server supports keep-alive
-                if (headerSection.find("Connection: keep-alive") != std::string::npos) {
-                    keepAliveServer = true;
-                }
-                
-                // Check for Content-Length
-                size_t contentLengthPos = headerSection.find("Content-Length: ");
-                if (contentLengthPos != std::string::npos) {
-                    size_t valueStart = contentLengthPos + 16; // Length of "Content-Length: "
-                    size_t valueEnd = headerSection.find("\r\n", valueStart);
-                    std::string lengthStr = headerSection.substr(valueStart, valueEnd - valueStart);
-                    contentLength = std::stoul(lengthStr);
-                }
-                
-                // Check for chunked encoding
-                if (headerSection.find("Transfer-Encoding: chunked") != std::string::npos) {
-                    chunkedEncoding = true;
-                }
-                
-                // Calculate how much of the body we've already received
-                receivedBodyBytes = responseHeaders.length() - (headerEnd + 4); // +4 for \r\n\r\n
-                
-                // Send the complete headers and any part of the body we've received to the client
-                if (send(clientSocket, responseHeaders.c_str(), responseHeaders.length(), 0) < 0) {
-                    // logger->log(LogLevel::ERROR, "Failed to send response headers to client");
-                    break;
+    if (body.complete()) {
+        // Everything after the head belongs to the next request
+        req.remainder = req.body;
+        // A reused connection the origin closed before answering is retried once on a fresh one
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            bool reused = false;
+            bool sendFailed = false;
+            int serverSocket = sendRequest(req.host, req.port, head, attempt == 0 ? POOLED : FRESH, reused, sendFailed,
+                                           &req.trace);
+            bool mayRetry = attempt == 0 && reused && isIdempotent(req.method);
+            if (serverSocket < 0) {
+                if (sendFailed && mayRetry) {
+                    noteRetry(req, logger);
+                    continue;
                 }
-                
-                // If there's no body or we've already received the complete body
-                if ((contentLength > 0 && receivedBodyBytes >= contentLength) || 
-                    (contentLength == 0 && !chunkedEncoding)) {
-                    break;
+                if (sendFailed) {
+                    logger->log(Logger::LogLevel::ERROR, "Failed to send request to server");
+                    sendErrorResponse(clientSocket, 500, "Internal Server Error", &req.trace);
+                } else {
+                    logger->log(Logger::LogLevel::ERROR, "Failed to connect to server: " + req.host + ":" + req.port);
+                    sendErrorResponse(clientSocket, 502, "Bad Gateway", &req.trace);
                 }
-            }
-        } else {
-            // We've already sent the headers, now just forward the body data directly
-            if (send(clientSocket, buffer, bytesRead, 0) < 0) {
-                // logger->log(LogLevel::ERROR, "Failed to send response body to client");
-                break;
+                return false;
             }
             
-            receivedBodyBytes += bytesRead;
+            auto sent = std::chrono::steady_clock::now();
+            if (attempt == 0) {
+                serverSocket = hedge(req, head, serverSocket, reused, sent, logger);
+                mayRetry = reused && isIdempotent(req.method);
+            }
             
-            // If we know the content length and we've received all data, exit the loop
-            if (contentLength > 0 && receivedBodyBytes >= contentLength) {
+            // Read and forward the response from the server to the client
+            RelayResult result = relayResponse(req, req.port, serverSocket, clientSocket, sent,
+                                               logger, captured, captureLimit, mayRetry, parsed);
+            if (result == RELAY_NO_RESPONSE && mayRetry) {
+                noteRetry(req, logger);
+                continue;
+            }
+            break;
+        }
+    } else {
+        // The body is streamed and cannot be sent twice, so there is a single attempt
+        int serverSocket = connectToServer(req.host, req.port, POOLED, nullptr, &req.trace);
+        if (serverSocket < 0) {
+            logger->log(Logger::LogLevel::ERROR, "Failed to connect to server: " + req.host + ":" + req.port);
+            sendErrorResponse(clientSocket, 502, "Bad Gateway", &req.trace);
+            return false;
+        }
+        // Send the head, then stream the body through as it arrives
+        if (!sendHead(serverSocket, head)) {
+            logger->log(Logger::LogLevel::ERROR, "Failed to send " + req.method + " request to server: " +
+                        std::string(strerror(errno)));
+            releaseConnection(req.host, req.port, serverSocket, false);
+            sendErrorResponse(clientSocket, 502, "Bad Gateway", &req.trace);
+            return false;
+        }
+        if (expectContinue) {
+            ContinueResult decision = CONTINUE_SEND_BODY;
+            if (uploads.answerLocally) {
+                ++continuedLocally;
+                sendAll(clientSocket, "HTTP/1.1 100 Continue\r\n\r\n", 25);
+            } else {
+                decision = awaitContinue(req, serverSocket, clientSocket, logger);
+            }
+            if (decision == CONTINUE_FAILED) {
+                releaseConnection(req.host, req.port, serverSocket, false);
+                sendErrorResponse(clientSocket, 502, "Bad Gateway", &req.trace);
+                return false;
+            }
+            if (decision == CONTINUE_ANSWERED) {
+                // The origin still counts on a body it will never get, neither side can be reused
+                ++refusedUploads;
+                logger->log("Origin answered " + req.method + " " + req.url + " without its body", clientId);
+                auto sent = std::chrono::steady_clock::now();
+                relayResponse(req, req.port, serverSocket, clientSocket, sent, logger, captured, captureLimit, false,
+                              parsed, false);
+                return false;
+            }
+        }
+        if (!relayRequestBody(req, body, clientSocket, serverSocket, logger)) {
+            releaseConnection(req.host, req.port, serverSocket, false);
+            return false;
+        }
+        auto sent = std::chrono::steady_clock::now();
+        relayResponse(req, req.port, serverSocket, clientSocket, sent, logger, captured, captureLimit, false, parsed);
+    }
+    
+    logger->event(EVENT_COMPLETED, clientId, req.method);
+    return true;
+}
+
+/*
+@brief: Send req upstream and read the complete response into response instead of
+        streaming it to a client. Used to fill the segment cache, so chunked responses
+        are refused. When parsed is set, it receives the parser that read the response.
+        With expectedStatus set, any other answer is given up after its head, or streamed
+        to relaySocket when one is given (relayed is then set and the return value tells
+        whether the client got all of it); with sizeLimit set, a response that grows past
+        it is given up too.
+*/
+bool MessageForwarder::fetchResponse(HttpRequest& req, std::string& response, std::shared_ptr<Logger> logger,
+                                     ResponseFramer* parsed, int expectedStatus, size_t sizeLimit,
+                                     int relaySocket, bool* relayed) {
+    OriginLimiter::Slot slot(limiter, req.host, req.port, timers->phases().originQueue);
+    if (!slot.admitted()) {
+        logger->log(Logger::LogLevel::WARNING, "Too many requests in flight to " + req.host + ":" + req.port);
+        return false;
+    }
+    RequestHead head;
+    if (!buildForwardRequest(req, head)) {
+        return false;
+    }
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        bool reused = false;
+        bool sendFailed = false;
+        int serverSocket = sendRequest(req.host, req.port, head, attempt == 0 ? POOLED : FRESH, reused, sendFailed,
+                                       &req.trace);
+        bool mayRetry = attempt == 0 && reused && isIdempotent(req.method);
+        if (serverSocket < 0) {
+            if (sendFailed && mayRetry) {
+                noteRetry(req, logger);
+                continue;
+            }
+            logger->log(Logger::LogLevel::ERROR, sendFailed ? "Failed to send request to server"
+                                                            : "Failed to connect to server: " + req.host + ":" + req.port);
+            return false;
+        }
+        auto sent = std::chrono::steady_clock::now();
+
+        ResponseFramer framer(req.method == "HEAD");
+        char buffer[BUFFER_SIZE];
+        ssize_t bytesRead = 0;
+        bool trailing = false;
+        bool relaying = false;
+        bool clientGone = false;
+        size_t received = 0;
+        response.clear();
+        TimerService::TimerId deadline = timers->arm(serverSocket, timers->phases().firstByte);
+        RequestTrace::Clock::time_point firstByte;
+        while (!framer.complete() && !framer.error()) {
+            bytesRead = recv(serverSocket, buffer, BUFFER_SIZE, 0);
+            if (bytesRead <= 0) {
                 break;
             }
-            
-            // For chunked encoding, look for the end chunk marker "0\r\n\r\n"
-            if (chunkedEncoding) {
-                std::string chunk(buffer, bytesRead);
-                if (chunk.find("0\r\n\r\n") != std::string::npos) {
+            if (received == 0) {
+                firstByte = RequestTrace::Clock::now();
+                req.trace.ttfbMicros = RequestTrace::micros(sent, firstByte);
+            }
+            received += bytesRead;
+            timers->rearm(deadline, timers->phases().idleBody);
+            bool hadHeaders = framer.headersComplete();
+            size_t used = framer.feed(buffer, bytesRead);
+            trailing = used < static_cast<size_t>(bytesRead);
+            if (relaying) {
+                if (!sendAll(relaySocket, buffer, used)) {
+                    clientGone = true;
                     break;
                 }
+                req.trace.bytesOut += used;
+                continue;
+            }
+            response.append(buffer, used);
+            bool unwanted = sizeLimit > 0 && response.size() > sizeLimit;
+            if (!hadHeaders && framer.headersComplete()) {
+                recordResponse(req.host, req.port, sent, framer.statusCode());
+                bool unexpected = expectedStatus != 0 && framer.statusCode() != expectedStatus;
+                // Another answer goes to the client as it is, nothing needs slicing then
+                if (unexpected && relaySocket >= 0) {
+                    relaying = true;
+                    req.trace.status = framer.statusCode();
+                    if (relayed != nullptr) {
+                        *relayed = true;
+                    }
+                    if (!sendAll(relaySocket, response.data(), response.size())) {
+                        clientGone = true;
+                        break;
+                    }
+                    req.trace.bytesOut += response.size();
+                    response.clear();
+                    continue;
+                }
+                // Callers slice the body by offset, they need it unframed
+                unwanted = unwanted || framer.mode() == ResponseFramer::CHUNKED || unexpected;
+            }
+            if (unwanted) {
+                timers->cancel(deadline);
+                releaseConnection(req.host, req.port, serverSocket, false);
+                if (parsed != nullptr) {
+                    *parsed = std::move(framer);
+                }
+                return false;
+            }
+        }
+        bool timedOut = timers->cancel(deadline);
+        if (received == 0 && !timedOut && mayRetry) {
+            releaseConnection(req.host, req.port, serverSocket, false);
+            noteRetry(req, logger);
+            continue;
+        }
+        if (clientGone) {
+            releaseConnection(req.host, req.port, serverSocket, false);
+            if (parsed != nullptr) {
+                *parsed = std::move(framer);
+            }
+            return false;
+        }
+        if (received > 0) {
+            req.trace.transferMicros = RequestTrace::micros(firstByte, RequestTrace::Clock::now());
+        }
+        if (timedOut) {
+            logger->log(Logger::LogLevel::ERROR, "Timed out waiting for " + req.host + ":" + req.port);
+        } else if (bytesRead == 0) {
+            framer.finish();
+        }
+        if (!framer.headersComplete()) {
+            recordResponse(req.host, req.port, sent, 0);
+        }
+        bool complete = framer.complete() && !framer.error() && !timedOut;
+        releaseConnection(req.host, req.port, serverSocket, complete && framer.keepAlive() && !trailing && bytesRead > 0);
+        if (parsed != nullptr) {
+            *parsed = std::move(framer);
+        }
+        return complete;
+    }
+    return false;
+}
+
+/*
+@brief: Hedge a GET: if serverSocket shows no response within the policy's threshold, send
+        the same request on a second, freshly dialled connection and keep whichever answers
+        first. The other connection is closed. The original is watched while the duplicate
+        dials, and the duplicate takes its own origin limiter slot without queueing for it.
+        Returns the socket to read from, with reused and sent updated.
+*/
+int MessageForwarder::hedge(const HttpRequest& req, const RequestHead& head, int serverSocket, bool& reused,
+                            std::chrono::steady_clock::time_point& sent, std::shared_ptr<Logger> logger) {
+    std::chrono::milliseconds delay;
+    if (!hedging || req.method != "GET" || !hedging->thresholdFor(req.host, req.port, delay)) {
+        return serverSocket;
+    }
+    struct pollfd fds[2];
+    fds[0].fd = serverSocket;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    if (poll(fds, 1, static_cast<int>(delay.count())) != 0) {
+        return serverSocket;
+    }
+    OriginLimiter::Slot slot(limiter, req.host, req.port, std::chrono::milliseconds(0));
+    if (!slot.admitted() || !hedging->tryHedge()) {
+        return serverSocket;
+    }
+
+    // A pooled connection could be stale and look like an instant answer, so dial a new one.
+    // The dial gives up as soon as the original has something to read
+    int hedgeSocket = connectToServer(req.host, req.port, FRESH, nullptr, nullptr, serverSocket);
+    if (hedgeSocket < 0) {
+        return serverSocket;
+    }
+    if (!sendHead(hedgeSocket, head)) {
+        releaseConnection(req.host, req.port, hedgeSocket, false);
+        return serverSocket;
+    }
+    auto hedgeSent = std::chrono::steady_clock::now();
+    logger->log(Logger::LogLevel::DEBUG, "No response from " + req.host + ":" + req.port + " after " +
+                std::to_string(delay.count()) + " ms, hedging " + req.url);
+
+    // Race the two until one is readable or the first one's time-to-first-byte runs out
+    fds[1].fd = hedgeSocket;
+    fds[1].events = POLLIN;
+    auto deadline = sent + timers->phases().firstByte;
+    while (true) {
+        fds[0].revents = 0;
+        fds[1].revents = 0;
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        int ready = poll(fds, 2, static_cast<int>(std::max<long long>(left.count(), 0)));
+        if (ready < 0 && errno == EINTR) {
+            continue;
+        }
+        // Only response bytes count as an answer, an error or a close does not
+        char byte;
+        if (ready > 0 && fds[0].revents == 0 && (fds[1].revents & (POLLERR | POLLHUP)) == 0 &&
+            (fds[1].revents & POLLIN) != 0 && recv(hedgeSocket, &byte, 1, MSG_PEEK | MSG_DONTWAIT) > 0) {
+            // The duplicate answered first, the original is cancelled
+            releaseConnection(req.host, req.port, serverSocket, false);
+            hedging->recordWin();
+            reused = false;
+            sent = hedgeSent;
+            return hedgeSocket;
+        }
+        releaseConnection(req.host, req.port, hedgeSocket, false);
+        return serverSocket;
+    }
+}
+
+/*
+@brief: Get a connection to the origin and write the request head to it. reused tells whether the
+        connection came from the pool. Returns the socket, or -1 when no connection could
+        be made or, with sendFailed set, when the write failed (the socket is released).
+*/
+int MessageForwarder::sendRequest(const std::string& host, const std::string& port, const RequestHead& head,
+                                  ConnectMode mode, bool& reused, bool& sendFailed, RequestTrace* trace) {
+    int serverSocket = connectToServer(host, port, mode, &reused, trace);
+    if (serverSocket < 0) {
+        return -1;
+    }
+    if (!sendHead(serverSocket, head)) {
+        releaseConnection(host, port, serverSocket, false);
+        sendFailed = true;
+        return -1;
+    }
+    return serverSocket;
+}
+
+void MessageForwarder::noteRetry(const HttpRequest& req, std::shared_ptr<Logger> logger) {
+    ++retries;
+    logger->log(Logger::LogLevel::INFO, "Pooled connection to " + req.host + ":" + req.port +
+                " was closed before responding, retrying " + req.method + " on a fresh one");
+}
+
+// Methods that can be repeated without changing the outcome (RFC 7231 section 4.2.2)
+bool MessageForwarder::isIdempotent(const std::string& method) {
+    return method == "GET" || method == "HEAD" || method == "PUT" || method == "DELETE" ||
+           method == "OPTIONS" || method == "TRACE";
+}
+
+MessageForwarder::Stats MessageForwarder::getStats() const {
+    Stats stats;
+    stats.retries = retries.load();
+    stats.continued = continued.load();
+    stats.continuedLocally = continuedLocally.load();
+    stats.refusedUploads = refusedUploads.load();
+    return stats;
+}
+
+// Whether the client waits for 100 Continue before sending its body; HTTP/1.0 clients never do
+bool MessageForwarder::expectsContinue(const HttpRequest& req) {
+    const std::string* expect = req.headers.find(HeaderMap::EXPECT);
+    return expect != nullptr && req.version != "HTTP/1.0" && strcasecmp(expect->c_str(), "100-continue") == 0;
+}
+
+/*
+@brief: After a head with Expect: 100-continue went upstream, wait for the origin to ask
+        for the body or to answer without it. Interim responses are relayed to the client
+        and taken off the socket, a final response is only peeked at and left for
+        relayResponse. An origin silent for the continue phase gets the body anyway and the
+        client a 100 Continue from us, as RFC 7231 section 5.1.1 allows.
+*/
+MessageForwarder::ContinueResult MessageForwarder::awaitContinue(const HttpRequest& req, int serverSocket,
+                                                                 int clientSocket, std::shared_ptr<Logger> logger) {
+    auto deadline = std::chrono::steady_clock::now() + timers->phases().expectContinue;
+    char buffer[MAX_INTERIM_HEAD];
+    while (true) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        if (left.count() <= 0) {
+            ++continuedLocally;
+            logger->log(Logger::LogLevel::INFO, req.host + ":" + req.port + " did not answer Expect: 100-continue, "
+                        "sending the body anyway");
+            return sendAll(clientSocket, "HTTP/1.1 100 Continue\r\n\r\n", 25) ? CONTINUE_SEND_BODY : CONTINUE_FAILED;
+        }
+        pollfd pfd = {serverSocket, POLLIN, 0};
+        int ready = poll(&pfd, 1, static_cast<int>(left.count()));
+        if (ready < 0 && errno != EINTR) {
+            return CONTINUE_FAILED;
+        }
+        if (ready <= 0) {
+            continue;
+        }
+        ssize_t peeked = recv(serverSocket, buffer, sizeof(buffer), MSG_PEEK);
+        if (peeked <= 0) {
+            logger->log(Logger::LogLevel::ERROR, req.host + ":" + req.port + " closed the connection before the body");
+            return CONTINUE_FAILED;
+        }
+        std::string_view data(buffer, peeked);
+        size_t headEnd = data.find("\r\n\r\n");
+        if (headEnd == std::string_view::npos) {
+            if (static_cast<size_t>(peeked) == sizeof(buffer)) {
+                return CONTINUE_ANSWERED;   // too long for an interim head, relayResponse deals with it
+            }
+            // Part of a head, give the rest a moment to arrive
+            poll(nullptr, 0, 10);
+            continue;
+        }
+        // Anything but an interim status is the origin's final answer
+        if (data.compare(0, 5, "HTTP/") != 0 || data.size() < 12 || data[9] != '1') {
+            return CONTINUE_ANSWERED;
+        }
+        size_t headLength = headEnd + 4;
+        recv(serverSocket, buffer, headLength, 0);
+        if (!sendAll(clientSocket, buffer, headLength)) {
+            return CONTINUE_FAILED;
+        }
+        if (data.compare(9, 3, "100") == 0) {
+            ++continued;
+            return CONTINUE_SEND_BODY;
+        }
+        // Other interim responses such as 103 Early Hints are passed on while we keep waiting
+    }
+}
+
+/*
+@brief: Stream one response from serverSocket to clientSocket, using the framer to know
+        exactly where it ends. The connection goes back to the pool only if it is reusable,
+        the response was read completely and nothing unexpected followed it. With retryable set, a
+        connection closed before the first response byte is reported as RELAY_NO_RESPONSE
+        and nothing is sent to the client, so the caller can try again.
+*/
+MessageForwarder::RelayResult MessageForwarder::relayResponse(HttpRequest& req, const std::string& port, int serverSocket,
+                                                              int clientSocket, std::chrono::steady_clock::time_point sent,
+                                                              std::shared_ptr<Logger> logger, std::string* captured,
+                                                              size_t captureLimit, bool retryable,
+                                                              ResponseFramer* parsed, bool reusable) {
+    ResponseFramer framer(req.method == "HEAD");
+    char buffer[BUFFER_SIZE];
+    ssize_t bytesRead = 0;
+    bool clientGone = false;
+    bool trailing = false;
+    size_t relayed = 0;
+    size_t received = 0;
+    // Until the first byte the time-to-first-byte deadline (counted from the send) applies, then the idle one
+    auto firstByteLeft = std::chrono::duration_cast<std::chrono::milliseconds>(
+        sent + timers->phases().firstByte - std::chrono::steady_clock::now());
+    TimerService::TimerId deadline = timers->arm(serverSocket, std::max(firstByteLeft, std::chrono::milliseconds(1)));
+    RequestTrace::Clock::time_point firstByte;
+    while (!framer.complete() && !framer.error()) {
+        bytesRead = recv(serverSocket, buffer, BUFFER_SIZE, 0);
+        if (bytesRead <= 0) {
+            break;
+        }
+        if (received == 0) {
+            firstByte = RequestTrace::Clock::now();
+            req.trace.ttfbMicros = RequestTrace::micros(sent, firstByte);
+        }
+        received += bytesRead;
+        timers->rearm(deadline, timers->phases().idleBody);
+        bool hadHeaders = framer.headersComplete();
+        size_t used = framer.feed(buffer, bytesRead);
+        // Bytes after the end of the response mean the origin broke framing
+        trailing = used < static_cast<size_t>(bytesRead);
+        if (!hadHeaders && framer.headersComplete()) {
+            recordResponse(req.host, port, sent, framer.statusCode());
+            req.trace.status = framer.statusCode();
+        }
+        if (captured != nullptr) {
+            if (captured->size() + used > captureLimit) {
+                // Too large to cache, stop copying
+                captured->clear();
+                captured = nullptr;
+            } else {
+                captured->append(buffer, used);
+                // Interim 1xx heads went to the client, the cache keeps the final response only
+                if (!hadHeaders && framer.headersComplete()) {
+                    captured->erase(0, framer.interimLength());
+                }
             }
         }
+        // A slow client may take a chunk in several writes, a short one must not lose the rest
+        if (!sendAll(clientSocket, buffer, used)) {
+            clientGone = true;
+            break;
+        }
+        relayed += used;
     }
-    
-    //Handle read errors or connection closed by server
-    if (bytesRead < 0) {
+    req.trace.bytesOut += relayed;
+    if (received > 0) {
+        req.trace.transferMicros = RequestTrace::micros(firstByte, RequestTrace::Clock::now());
+    }
+
+    bool timedOut = timers->cancel(deadline);
+    if (received == 0 && !timedOut && retryable) {
+        releaseConnection(req.host, port, serverSocket, false);
+        return RELAY_NO_RESPONSE;
+    }
+    if (timedOut) {
+        // The timer shut the socket down, the EOF seen is not the origin's
+        logger->log(Logger::LogLevel::ERROR, "Timed out waiting for " + req.host + ":" + port);
+    } else if (bytesRead < 0) {
         logger->log(Logger::LogLevel::ERROR, "Error reading response from server: " + std::string(strerror(errno)));
+    } else if (bytesRead == 0) {
+        framer.finish();
     }
-    
-    //Close the server connection if keep-alive is not supported/requested
-    if (!keepAliveServer) {
-        close(serverSocket);
-    } else {
-        // Store the connection for future use
-        saveKeepAliveConnection(req.host, req.port, serverSocket);
+    if (!framer.headersComplete()) {
+        recordResponse(req.host, port, sent, 0);
+        // Nothing reached the client yet, so it can still get a proper error
+        if (relayed == 0 && !clientGone) {
+            sendErrorResponse(clientSocket, timedOut ? 504 : 502, timedOut ? "Gateway Timeout" : "Bad Gateway",
+                              &req.trace);
+        }
     }
-    
-    logger->log(Logger::LogLevel::INFO, "Completed forwarding GET request for client " + std::to_string(clientId));
+    if (framer.error()) {
+        logger->log(Logger::LogLevel::ERROR, "Malformed or truncated response from " + req.host + ":" + port);
+    }
+    bool complete = framer.complete() && !framer.error() && !clientGone && !timedOut;
+    // A truncated response must not end up in the cache
+    if (!complete && captured != nullptr) {
+        captured->clear();
+    }
+    //Only a fully read response leaves the connection reusable
+    releaseConnection(req.host, port, serverSocket,
+                      reusable && complete && framer.keepAlive() && !trailing && bytesRead > 0);
+    if (parsed != nullptr) {
+        *parsed = std::move(framer);
+    }
+    if (complete) {
+        return RELAY_COMPLETE;
+    }
+    return received == 0 ? RELAY_NO_RESPONSE : RELAY_INCOMPLETE;
 }
 
-// Helper function to build the forwarded request
-std::string MessageForwarder::buildForwardRequest(const HttpRequest& req) {
-    std::stringstream ss;
+/*
+@brief: Lay out the forwarded request head as pieces of req: request line with the origin-form
+        target, end-to-end headers, then our own Connection header. Nothing is copied, so req
+        must outlive head. Returns false when the head has more pieces than one write can take.
+*/
+bool MessageForwarder::buildForwardRequest(const HttpRequest& req, RequestHead& head, bool chunkedBody) {
+    head.count = 0;
+    head.length = 0;
     
-    // Build the request line
-    ss << req.method << " " << req.request << " " << req.version << "\r\n";
+    // Build the request line, origin servers get the path rather than the absolute URL
+    const char* target = req.url.data();
+    size_t targetLength = req.url.size();
+    size_t schemeEnd = req.url.find("://");
+    if (schemeEnd != std::string::npos) {
+        size_t pathStart = req.url.find('/', schemeEnd + 3);
+        if (pathStart == std::string::npos) {
+            target = "/";
+            targetLength = 1;
+        } else {
+            target += pathStart;
+            targetLength -= pathStart;
+        }
+    }
+    addPiece(head, req.method.data(), req.method.size());
+    addPiece(head, " ", 1);
+    addPiece(head, target, targetLength);
+    addPiece(head, " ", 1);
+    addPiece(head, req.version.data(), req.version.size());
+    addPiece(head, "\r\n", 2);
     
     // Add headers
-    for (const auto& header : req.headers) {
+    bool fits = true;
+    req.headers.forEach([&head, &fits, chunkedBody](HeaderMap::Id id, const HeaderMap::Field& field) {
         // Skip hop-by-hop headers
-        if (strcasecmp(header.first.c_str(), "Connection") == 0 ||
-            strcasecmp(header.first.c_str(), "Keep-Alive") == 0 ||
-            strcasecmp(header.first.c_str(), "Proxy-Connection") == 0 ||
-            strcasecmp(header.first.c_str(), "Proxy-Authorization") == 0 ||
-            strcasecmp(header.first.c_str(), "TE") == 0 ||
-            strcasecmp(header.first.c_str(), "Trailer") == 0 ||
-            strcasecmp(header.first.c_str(), "Transfer-Encoding") == 0 ||
-            strcasecmp(header.first.c_str(), "Upgrade") == 0) {
-            continue;
+        switch (id) {
+            case HeaderMap::CONNECTION:
+            case HeaderMap::KEEP_ALIVE:
+            case HeaderMap::PROXY_CONNECTION:
+            case HeaderMap::PROXY_AUTHORIZATION:
+            case HeaderMap::TE:
+            case HeaderMap::TRAILER:
+            case HeaderMap::TRANSFER_ENCODING:
+            case HeaderMap::UPGRADE:
+                return;
+            case HeaderMap::CONTENT_LENGTH:
+                if (chunkedBody) {
+                    return;
+                }
+                break;
+            default:
+                break;
+        }
+        // Four pieces per header and two more to finish the head
+        if (head.count + 6 > MAX_HEAD_PIECES) {
+            fits = false;
+            return;
         }
-        ss << header.first << ": " << header.second << "\r\n";
+        addPiece(head, field.name.data(), field.name.size());
+        addPiece(head, ": ", 2);
+        addPiece(head, field.value.data(), field.value.size());
+        addPiece(head, "\r\n", 2);
+    });
+    if (!fits) {
+        return false;
     }
     
-    // Add our own Connection header if needed
-    ss << "Connection: keep-alive\r\n";
-    
-    // End of headers
-    ss << "\r\n";
-    
-    return ss.str();
+    // A chunked body is passed through as it is, and chunked overrides any Content-Length
+    if (chunkedBody) {
+        addPiece(head, "Transfer-Encoding: chunked\r\n", 28);
+    }
+    // Add our own Connection header, and end the headers
+    addPiece(head, "Connection: keep-alive\r\n\r\n", 26);
+    return true;
+}
+
+void MessageForwarder::addPiece(RequestHead& head, const char* data, size_t length) {
+    head.pieces[head.count].iov_base = const_cast<char*>(data);
+    head.pieces[head.count].iov_len = length;
+    ++head.count;
+    head.length += length;
 }
 
 /*
-@brief: Helper function to connect to the target server
+@brief: Write a request head with as few system calls as the kernel allows. After a short
+        write the interrupted piece is finished on its own and the rest goes out vectored again.
 */
- int MessageForwarder::connectToServer(const std::string& host, const std::string& port) {
-    // First check if we already have a keep-alive connection
-    int existingSocket = getKeepAliveConnection(host, port);
-    if (existingSocket > 0) {
-        // Test if the connection is still valid
-        char test;
-        if (recv(existingSocket, &test, 1, MSG_PEEK | MSG_DONTWAIT) == 0) {
-            close(existingSocket);
-            removeKeepAliveConnection(host, port);
-        } else {
-            return existingSocket;
+bool MessageForwarder::sendHead(int socket, const RequestHead& head) {
+    size_t index = 0;
+    while (index < head.count) {
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = const_cast<iovec*>(head.pieces + index);
+        message.msg_iovlen = head.count - index;
+        ssize_t written = sendmsg(socket, &message, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            return false;
+        }
+        // Skip the pieces that went out whole
+        size_t done = static_cast<size_t>(written);
+        while (index < head.count && done >= head.pieces[index].iov_len) {
+            done -= head.pieces[index].iov_len;
+            ++index;
+        }
+        if (done > 0) {
+            const char* rest = static_cast<const char*>(head.pieces[index].iov_base) + done;
+            if (!sendAll(socket, rest, head.pieces[index].iov_len - done)) {
+                return false;
+            }
+            ++index;
         }
     }
-    
-    // Create a new connection
-    struct addrinfo hints, *res;
-    int sockfd;
-    
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    
-    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+    return true;
+}
+
+/*
+@brief: Helper function to connect to the target server. POOLED prefers an idle pooled
+        connection, FRESH always dials (retries), TUNNEL dials a connection that never
+        returns to the pool. reused is set when the pool supplied the connection.
+*/
+int MessageForwarder::connectToServer(const std::string& host, const std::string& port, ConnectMode mode, bool* reused,
+                                      RequestTrace* trace, int cancelFd) {
+    auto begin = std::chrono::steady_clock::now();
+    // An origin with an open circuit is refused without any network activity
+    if (health && !health->allow(host, port)) {
         return -1;
     }
+    if (mode == POOLED && pool) {
+        int pooled = pool->acquire(host, port);
+        if (pooled >= 0) {
+            if (reused != nullptr) {
+                *reused = true;
+            }
+            if (trace != nullptr) {
+                trace->upstreamReused = true;
+                trace->dnsMicros = 0;
+                trace->connectMicros = 0;
+            }
+            pool->recordWait(true, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin));
+            if (preconnector) {
+                preconnector->onAcquire(host, port, true);
+            }
+            return pooled;
+        }
+    }
     
-    sockfd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
-    if (sockfd < 0) {
-        freeaddrinfo(res);
+    // Fail fast for destinations that just failed to resolve or connect
+    if (negativeCache && negativeCache->isKnownBad(host, port)) {
         return -1;
     }
     
-    // Non-blocking mode
-    int flags = fcntl(sockfd, F_GETFL, 0);
-    fcntl(sockfd, F_SETFL, flags | O_NONBLOCK);
-    
-    // Attempt to connect
-    int connectResult = connect(sockfd, res->ai_addr, res->ai_addrlen);
-    if (connectResult < 0) {
-        if (errno == EINPROGRESS) {
-            fd_set fdset;
-            struct timeval tv;
-            
-            FD_ZERO(&fdset);
-            FD_SET(sockfd, &fdset);
-            // 5 s Time out
-            tv.tv_sec = 5;
-            tv.tv_usec = 0;
-            if (select(sockfd + 1, NULL, &fdset, NULL, &tv) == 1) {
-                int so_error;
-                socklen_t len = sizeof so_error;
-                getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &so_error, &len);
-                
-                if (so_error != 0) {
-                    close(sockfd);
-                    freeaddrinfo(res);
-                    return -1;
-                }
-            } else {
-                // Error
-                close(sockfd);
-                freeaddrinfo(res);
-                return -1;
+    // Race the origin's addresses for a new connection
+    Dialer::Result result;
+    std::chrono::microseconds resolveTime(0);
+    auto dialStart = std::chrono::steady_clock::now();
+    int sockfd = dialer->dial(host, port, result, &resolveTime, cancelFd);
+    if (trace != nullptr) {
+        // A retry on a fresh connection replaces what the pooled attempt noted
+        trace->upstreamReused = false;
+        trace->dnsMicros = static_cast<uint32_t>(resolveTime.count());
+        trace->connectMicros = RequestTrace::micros(dialStart + resolveTime, std::chrono::steady_clock::now());
+    }
+    if (sockfd < 0 && result == Dialer::CANCELLED) {
+        return -1;   // the caller lost interest, says nothing about the origin
+    }
+    if (sockfd < 0) {
+        if (health) {
+            health->recordFailure(host, port);
+        }
+        if (result == Dialer::DNS_FAILURE) {
+            if (negativeCache) {
+                negativeCache->recordDnsFailure(host);
             }
         } else {
-            close(sockfd);
-            freeaddrinfo(res);
-            return -1;
+            recordConnectFailure(host, port);
         }
+        return -1;
+    }
+    if (pool) {
+        pool->recordWait(false, std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin));
+    }
+    if (mode != TUNNEL && preconnector) {
+        preconnector->onAcquire(host, port, false);
     }
-    // Blocking mode
-    fcntl(sockfd, F_SETFL, flags);
-    freeaddrinfo(res);
     return sockfd;
 }
 
 /*
- @brief: function to send an error response to the client
+@brief: Feed the outcome of one exchange to the health tracker. Status 0 means no
+        response arrived, 5xx responses count as failures too.
+*/
+void MessageForwarder::recordResponse(const std::string& host, const std::string& port,
+                                      std::chrono::steady_clock::time_point sent, int status) {
+    if (!health) {
+        return;
+    }
+    if (status == 0 || status >= 500) {
+        health->recordFailure(host, port);
+    } else {
+        health->recordSuccess(host, port, std::chrono::duration_cast<std::chrono::microseconds>(
+                                              std::chrono::steady_clock::now() - sent));
+    }
+}
+
+void MessageForwarder::recordConnectFailure(const std::string& host, const std::string& port) {
+    if (negativeCache) {
+        negativeCache->recordConnectFailure(host, port);
+    }
+}
+
+/*
+ @brief: function to send an error response to the client, noting it in trace when given
 */
- void MessageForwarder::sendErrorResponse(int clientSocket, int statusCode, const std::string& statusText) {
+ void MessageForwarder::sendErrorResponse(int clientSocket, int statusCode, const std::string& statusText,
+                                          RequestTrace* trace) {
     std::stringstream ss;
     ss << "HTTP/1.1 " << statusCode << " " << statusText << "\r\n";
     ss << "Content-Type: text/html\r\n";
@@ -263,247 +820,99 @@ std::string MessageForwarder::buildForwardRequest(const HttpRequest& req) {
     ss << body;
     
     std::string response = ss.str();
-    send(clientSocket, response.c_str(), response.length(), 0);
+    if (!sendAll(clientSocket, response.c_str(), response.length())) {
+        return;
+    }
+    if (trace != nullptr) {
+        trace->status = statusCode;
+        trace->bytesOut += response.length();
+    }
 }
 
 /*
-@ brief: Helper function to get a keep-alive connection
+@brief: Return a connection to the shared pool if it can carry another request, close it otherwise
 */
-int MessageForwarder::getKeepAliveConnection(const std::string& host, const std::string& port) {
-    std::string key = host + ":" + port;
-    std::lock_guard<std::mutex> guard(keepAliveMutex); 
-    auto it = keepAliveConnections.find(key);
-    if (it != keepAliveConnections.end()) {
-        return it->second;
-    }
-    return -1;
-}
-
-void MessageForwarder::saveKeepAliveConnection(const std::string& host, const std::string& port, int socket) {
-    std::string key = host + ":" + port;
-    std::lock_guard<std::mutex> guard(keepAliveMutex);
-    
-    // If there was an old connection, close it first
-    auto it = keepAliveConnections.find(key);
-    if (it != keepAliveConnections.end()) {
-        close(it->second);
+void MessageForwarder::releaseConnection(const std::string& host, const std::string& port, int socket, bool reusable) {
+    if (preconnector) {
+        preconnector->onRelease(host, port);
+    }
+    if (reusable && pool) {
+        pool->release(host, port, socket);
+    } else {
+        close(socket);
     }
-    
-    keepAliveConnections[key] = socket;
-}
-
-void MessageForwarder::removeKeepAliveConnection(const std::string& host, const std::string& port) {
-    std::string key = host + ":" + port;
-    std::lock_guard<std::mutex> guard(keepAliveMutex);
-    
-    keepAliveConnections.erase(key);
 }
 
-void MessageForwarder::forwardPost(HttpRequest& req, int clientSocket, int clientId, std::shared_ptr<Logger> logger) {
-    logger->log(Logger::LogLevel::INFO, "Forwarding POST request for client " + std::to_string(clientId) + ": " + req.url);
-    
-    //Connect to the target server
-    std::string port = req.port.empty() ? "80" : req.port;
-    int serverSocket = connectToServer(req.host, port);
-    
-    if (serverSocket < 0) {
-        logger->log(Logger::LogLevel::ERROR, "Failed to connect to server: " + req.host + ":" + port);
-        sendErrorResponse(clientSocket, 502, "Bad Gateway");
-        return;
-    }
-    
-    //Check Content-Length header
-    size_t contentLength = 0;
-    auto contentLengthIt = req.headers.find("Content-Length");
-    if (contentLengthIt != req.headers.end()) {
-        try {
-            contentLength = std::stoul(contentLengthIt->second);
-        } catch (const std::exception& e) {
-            logger->log(Logger::LogLevel::ERROR, "Invalid Content-Length: " + contentLengthIt->second);
-            close(serverSocket);
-            sendErrorResponse(clientSocket, 400, "Bad Request");
-            return;
+/*
+@brief: Copy a request body from the client to the origin as it arrives, delimited by body.
+        The bytes that came with the request head go first, anything read past the body is
+        left in req.remainder. Memory use is one buffer no matter how large the body is. On failure the client has been answered where that is still
+        possible and false is returned; the origin connection is then unusable.
+*/
+bool MessageForwarder::relayRequestBody(HttpRequest& req, ResponseFramer& body, int clientSocket,
+                                        int serverSocket, std::shared_ptr<Logger> logger) {
+    size_t used = body.feed(req.body.data(), req.body.size());
+    bool sendFailed = !sendAll(serverSocket, req.body.data(), used);
+    req.remainder.assign(req.body, used, std::string::npos);
+    req.trace.bytesIn += used;
+    char buffer[BUFFER_SIZE];
+    ssize_t bytesRead = 1;
+    TimerService::TimerId deadline = timers->arm(clientSocket, timers->phases().idleBody);
+    while (!sendFailed && !body.complete() && !body.error()) {
+        bytesRead = recv(clientSocket, buffer, BUFFER_SIZE, 0);
+        if (bytesRead <= 0) {
+            break;
         }
+        timers->rearm(deadline, timers->phases().idleBody);
+        used = body.feed(buffer, bytesRead);
+        sendFailed = !sendAll(serverSocket, buffer, used);
+        req.remainder.assign(buffer + used, bytesRead - used);
+        req.trace.bytesIn += used;
     }
-    
-    // Check for chunked encoding
-    bool chunkedEncoding = false;
-    auto transferEncodingIt = req.headers.find("Transfer-Encoding");
-    if (transferEncodingIt != req.headers.end() && 
-        transferEncodingIt->second.find("chunked") != std::string::npos) {
-        chunkedEncoding = true;
+    bool timedOut = timers->cancel(deadline);
+
+    if (sendFailed) {
+        logger->log(Logger::LogLevel::ERROR, "Failed to forward request body to server: " + std::string(strerror(errno)));
+        sendErrorResponse(clientSocket, 502, "Bad Gateway", &req.trace);
+        return false;
     }
-    
-    // If don't have Content-Length don't have chunked encoding 
-    if (contentLength == 0 && !chunkedEncoding && !req.body.empty()) {
-        logger->log(Logger::LogLevel::ERROR, "POST request without proper Content-Length or Transfer-Encoding");
-        close(serverSocket);
-        sendErrorResponse(clientSocket, 400, "Bad Request");
-        return;
+    if (body.error()) {
+        logger->log(Logger::LogLevel::ERROR, "Malformed chunked request body from client");
+        sendErrorResponse(clientSocket, 400, "Bad Request", &req.trace);
+        return false;
     }
-    
-    // Build the request to forward
-    std::string requestToSend = buildForwardRequest(req);
-    
-    // For POST requests, we need to append the body
-    requestToSend += req.body;
-    
-    // Send the request to the server
-    if (send(serverSocket, requestToSend.c_str(), requestToSend.length(), 0) < 0) {
-        logger->log(Logger::LogLevel::ERROR, "Failed to send POST request to server: " + std::string(strerror(errno)));
-        close(serverSocket);
-        sendErrorResponse(clientSocket, 500, "Internal Server Error");
-        return;
+    if (!body.complete()) {
+        logger->log(Logger::LogLevel::ERROR, timedOut ? "Timed out reading request body from client"
+                                                      : "Client closed connection before sending the whole body");
+        return false;
     }
-    
-    if (chunkedEncoding && req.body.find("0\r\n\r\n") == std::string::npos) {
-        logger->log(Logger::LogLevel::DEBUG, "Reading additional chunked data from client");
-        
-        char buffer[BUFFER_SIZE];
-        bool chunkedComplete = false;
-        
-        while (!chunkedComplete) {
-            ssize_t bytesRead = recv(clientSocket, buffer, BUFFER_SIZE - 1, 0);
-            
-            if (bytesRead <= 0) {
-                if (bytesRead < 0) {
-                    logger->log(Logger::LogLevel::ERROR, "Error reading chunked data from client: " + std::string(strerror(errno)));
-                } else {
-                    logger->log(Logger::LogLevel::ERROR, "Client closed connection while reading chunked data");
-                }
-                close(serverSocket);
-                return;
-            }
-            
-            buffer[bytesRead] = '\0';
-            std::string chunk(buffer, bytesRead);
-            
-            //Forward the chunk to the server
-            if (send(serverSocket, chunk.c_str(), chunk.length(), 0) < 0) {
-                logger->log(Logger::LogLevel::ERROR, "Failed to forward chunk to server: " + std::string(strerror(errno)));
-                close(serverSocket);
-                return;
-            }
-            
-            //Check if this is the last chunk
-            if (chunk.find("0\r\n\r\n") != std::string::npos) {
-                chunkedComplete = true;
-            }
+    return true;
+}
+
+// Write all of data, the kernel may take it in several pieces
+bool MessageForwarder::sendAll(int socket, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = send(socket, data, length, MSG_NOSIGNAL);
+        if (written < 0 && errno == EINTR) {
+            continue;
         }
-    }
-    
-    //Read and forward the response from the server to the client
-    bool keepAliveServer = false;
-    bool keepAliveClient = false;
-    
-    //Check if client requested keep-alive
-    auto clientConnectionIt = req.headers.find("Connection");
-    if (clientConnectionIt != req.headers.end() && 
-        strcasecmp(clientConnectionIt->second.c_str(), "keep-alive") == 0) {
-        keepAliveClient = true;
-    }
-    
-    //Process server response
-    char buffer[BUFFER_SIZE];
-    ssize_t bytesRead;
-    std::string responseHeaders;
-    bool headersComplete = false;
-    size_t responseContentLength = 0;
-    size_t receivedBodyBytes = 0;
-    bool responseChunked = false;
-    
-    //Read and process the response
-    while ((bytesRead = recv(serverSocket, buffer, BUFFER_SIZE - 1, 0)) > 0) {
-        buffer[bytesRead] = '\0';
-        
-        if (!headersComplete) {
-            responseHeaders.append(buffer, bytesRead);
-            
-            size_t headerEnd = responseHeaders.find("\r\n\r\n");
-            if (headerEnd != std::string::npos) {
-                headersComplete = true;
-                
-                //Extract headers to check for keep-alive and content length
-                std::string headerSection = responseHeaders.substr(0, headerEnd);
-                
-                //Check if server supports keep-alive
-                if (headerSection.find("Connection: keep-alive") != std::string::npos) {
-                    keepAliveServer = true;
-                }
-                
-                //Check for Content-Length
-                size_t contentLengthPos = headerSection.find("Content-Length: ");
-                if (contentLengthPos != std::string::npos) {
-                    size_t valueStart = contentLengthPos + 16; // Length of "Content-Length: "
-                    size_t valueEnd = headerSection.find("\r\n", valueStart);
-                    std::string lengthStr = headerSection.substr(valueStart, valueEnd - valueStart);
-                    responseContentLength = std::stoul(lengthStr);
-                }
-                
-                //Check for chunked encoding
-                if (headerSection.find("Transfer-Encoding: chunked") != std::string::npos) {
-                    responseChunked = true;
-                }
-                
-                //Calculate how much of the body we've already received
-                receivedBodyBytes = responseHeaders.length() - (headerEnd + 4); 
-                
-                //Send the complete headers and any part of the body we've received to the client
-                if (send(clientSocket, responseHeaders.c_str(), responseHeaders.length(), 0) < 0) {
-                    logger->log(Logger::LogLevel::ERROR, "Failed to send response headers to client");
-                    break;
-                }
-                
-                if ((responseContentLength > 0 && receivedBodyBytes >= responseContentLength) || 
-                    (responseContentLength == 0 && !responseChunked)) {
-                    break;
-                }
-            }
-        } else {
-            if (send(clientSocket, buffer, bytesRead, 0) < 0) {
-                logger->log(Logger::LogLevel::ERROR, "Failed to send response body to client");
-                break;
-            }
-            
-            receivedBodyBytes += bytesRead;
-        
-            if (responseContentLength > 0 && receivedBodyBytes >= responseContentLength) {
-                break;
-            }
-            
-            if (responseChunked) {
-                std::string chunk(buffer, bytesRead);
-                if (chunk.find("0\r\n\r\n") != std::string::npos) {
-                    break;
-                }
-            }
+        if (written <= 0) {
+            return false;
         }
+        data += written;
+        length -= written;
     }
-    
-    //Handle read errors or connection closed by server
-    if (bytesRead < 0) {
-        logger->log(Logger::LogLevel::ERROR, "Error reading response from server: " + std::string(strerror(errno)));
-    }
-    
-    //Close the server connection if keep-alive is not supported/requested
-    if (!keepAliveServer) {
-        close(serverSocket);
-    } else {
-        // Store the connection for future use
-        saveKeepAliveConnection(req.host, port, serverSocket);
-    }
-    
-    logger->log(Logger::LogLevel::INFO, "Completed forwarding POST request for client " + std::to_string(clientId));
+    return true;
 }
     
 void MessageForwarder::forwardConnect(HttpRequest& req, int clientSocket, int clientId, std::shared_ptr<Logger> logger) {
     logger->log(Logger::INFO, "Handling CONNECT request for client " + std::to_string(clientId) + ": " + req.host + ":" + req.port);
     
     //Connect to the target server
-    int serverSocket = connectToServer(req.host, req.port);
+    int serverSocket = connectToServer(req.host, req.port, TUNNEL, nullptr, &req.trace);
     if (serverSocket < 0) {
         logger->log(Logger::ERROR, "Failed to connect to server: " + req.host + ":" + req.port);
-        sendErrorResponse(clientSocket, 502, "Bad Gateway");
+        sendErrorResponse(clientSocket, 502, "Bad Gateway", &req.trace);
         return;
     }
     
@@ -512,11 +921,13 @@ void MessageForwarder::forwardConnect(HttpRequest& req, int clientSocket, int cl
     response += "Proxy-Agent: MyProxy/1.0\r\n";
     response += "\r\n";
     
-    if (send(clientSocket, response.c_str(), response.length(), 0) < 0) {
+    if (!sendAll(clientSocket, response.c_str(), response.length())) {
         logger->log(Logger::ERROR, "Failed to send Connection Established response to client");
         close(serverSocket);
         return;
     }
+    req.trace.status = 200;
+    req.trace.bytesOut += response.length();
     
     //Set up for tunneling data between client and server
     fd_set readFds;
@@ -531,6 +942,9 @@ void MessageForwarder::forwardConnect(HttpRequest& req, int clientSocket, int cl
     
     logger->log(Logger::LogLevel::INFO, "Established tunnel for client " + std::to_string(clientId) + " to " + req.host + ":" + req.port);
     
+    // An idle tunnel is ended by the timer shutting the client side down, which wakes select
+    TimerService::TimerId idleTimer = timers->arm(clientSocket, timers->phases().tunnelIdle);
+    
     // Tunnel Loop
     while (tunnelActive) {
         FD_ZERO(&readFds);
@@ -539,10 +953,8 @@ void MessageForwarder::forwardConnect(HttpRequest& req, int clientSocket, int cl
         
         int maxFd = std::max(clientSocket, serverSocket) + 1;
         struct timeval timeout;
-        timeout.tv_sec = 30; 
-        timeout.tv_usec = 0;
         
-        int activity = select(maxFd, &readFds, NULL, NULL, &timeout);
+        int activity = select(maxFd, &readFds, NULL, NULL, NULL);
         
         if (activity < 0) {
             if (errno == EINTR) {
@@ -551,13 +963,7 @@ void MessageForwarder::forwardConnect(HttpRequest& req, int clientSocket, int cl
             logger->log(Logger::LogLevel::ERROR, "Select error in tunnel: " + std::string(strerror(errno)));
             break;
         }
-        
-        if (activity == 0) {
-            logger->log(Logger::LogLevel::DEBUG, "Tunnel timeout for client " + std::to_string(clientId) + ", checking connection");
-            // Send a TCP keep-alive packet (optional, depends on implementation)
-            // If no activity for this long, we could just close the tunnel
-            continue;
-        }
+        timers->rearm(idleTimer, timers->phases().tunnelIdle);
         
         // Check if client has data to read
         if (FD_ISSET(clientSocket, &readFds)) {
@@ -580,7 +986,7 @@ void MessageForwarder::forwardConnect(HttpRequest& req, int clientSocket, int cl
             ssize_t totalBytesSent = 0;
             
             while (totalBytesSent < bytesRead) {
-                bytesSent = send(serverSocket, buffer + totalBytesSent, bytesRead - totalBytesSent, 0);
+                bytesSent = send(serverSocket, buffer + totalBytesSent, bytesRead - totalBytesSent, MSG_NOSIGNAL);
                 
                 if (bytesSent <= 0) {
                     if (bytesSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
@@ -608,6 +1014,7 @@ void MessageForwarder::forwardConnect(HttpRequest& req, int clientSocket, int cl
                 
                 totalBytesSent += bytesSent;
             }
+            req.trace.bytesIn += totalBytesSent;
             
             if (!tunnelActive) {
                 break;
@@ -635,7 +1042,7 @@ void MessageForwarder::forwardConnect(HttpRequest& req, int clientSocket, int cl
             ssize_t totalBytesSent = 0;
             
             while (totalBytesSent < bytesRead) {
-                bytesSent = send(clientSocket, buffer + totalBytesSent, bytesRead - totalBytesSent, 0);
+                bytesSent = send(clientSocket, buffer + totalBytesSent, bytesRead - totalBytesSent, MSG_NOSIGNAL);
                 
                 if (bytesSent <= 0) {
                     if (bytesSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
@@ -663,6 +1070,7 @@ void MessageForwarder::forwardConnect(HttpRequest& req, int clientSocket, int cl
                 
                 totalBytesSent += bytesSent;
             }
+            req.trace.bytesOut += totalBytesSent;
             
             if (!tunnelActive) {
                 break;
@@ -670,13 +1078,14 @@ void MessageForwarder::forwardConnect(HttpRequest& req, int clientSocket, int cl
         }
     }
     
+    if (timers->cancel(idleTimer)) {
+        logger->log(Logger::LogLevel::INFO, "Tunnel for client " + std::to_string(clientId) + " idle too long, closed");
+    }
+    
     // Clean up
     close(serverSocket);
     logger->log(Logger::LogLevel::INFO, "Closed tunnel for client " + std::to_string(clientId) + " to " + req.host + ":" + req.port);
     
     // Note: The client socket is not closed here as it's managed by the caller
 }
-<<<<<<< HEAD
-=======
 
->>>>>>> 412e57a72e1b369e9c713e5d0222099445729b29
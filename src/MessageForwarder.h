@@ -1,21 +1,104 @@
+#pragma once
 #include <string>
+#include <map>
+#include <memory>
+#include <mutex>
 #include "Logger.h"
-#include "Response.hpp"
 #include "HttpParser.h"
+#include "NegativeCache.h"
+#include "ConnectionPool.h"
+#include "Dialer.h"
+#include "Preconnector.h"
+#include "HealthTracker.h"
+#include "ResponseFramer.h"
+#include "TimerService.h"
+#include "HedgePolicy.h"
+#include "OriginLimiter.h"
+#include "UploadPolicy.h"
+#include <chrono>
+#include <atomic>
+#include <cstdint>
 #include <fcntl.h> 
+#include <sys/uio.h>
 #define BUFFER_SIZE 65536
+// Most pieces a forwarded request head may have, IOV_MAX on Linux
+#define MAX_HEAD_PIECES 1024
 class MessageForwarder {
 public:
-    void forwardGet(HttpRequest& req, int clientSocket,int clientId, std::shared_ptr<Logger> logger);
-    void forwardPost(HttpRequest& req, int clientSocket,int clientId, std::shared_ptr<Logger> logger);
+    struct Stats {
+        uint64_t retries;            // requests repeated after a pooled connection turned out closed
+        uint64_t continued;          // 100 Continue answers relayed from the origin
+        uint64_t continuedLocally;   // 100 Continue sent by the proxy itself
+        uint64_t refusedUploads;     // bodies answered without being read, by the origin or for size
+    };
+
+    MessageForwarder(std::shared_ptr<NegativeCache> negativeCache = nullptr,
+                     std::shared_ptr<ConnectionPool> pool = nullptr,
+                     std::shared_ptr<Dialer> dialer = nullptr,
+                     std::shared_ptr<Preconnector> preconnector = nullptr,
+                     std::shared_ptr<HealthTracker> health = nullptr,
+                     std::shared_ptr<TimerService> timers = nullptr,
+                     std::shared_ptr<HedgePolicy> hedging = nullptr,
+                     std::shared_ptr<OriginLimiter> limiter = nullptr,
+                     const UploadPolicy& uploads = UploadPolicy());
+    bool forwardRequest(HttpRequest& req, int clientSocket, int clientId, std::shared_ptr<Logger> logger,
+                        std::string* captured = nullptr, size_t captureLimit = 0, ResponseFramer* parsed = nullptr);
     void forwardConnect(HttpRequest& req, int clientSock, int clientId, std::shared_ptr<Logger> logger);
+    bool fetchResponse(HttpRequest& req, std::string& response, std::shared_ptr<Logger> logger,
+                       ResponseFramer* parsed = nullptr, int expectedStatus = 0, size_t sizeLimit = 0,
+                       int relaySocket = -1, bool* relayed = nullptr);
+    Stats getStats() const;
+    static bool sendAll(int socket, const char* data, size_t length);
 private:
-    void sendErrorResponse(int clientSocket, int statusCode, const std::string& statusText);
-    int getKeepAliveConnection(const std::string& host, const std::string& port);
-    void saveKeepAliveConnection(const std::string& host, const std::string& port, int socket);
-    void removeKeepAliveConnection(const std::string& host, const std::string& port);
-    std::string buildForwardRequest(const HttpRequest& req);
-    std::map<std::string, int> keepAliveConnections;
-    std::mutex keepAliveMutex;
-    int connectToServer(const std::string& host, const std::string& port);
+    enum ConnectMode { POOLED, FRESH, TUNNEL };
+    enum RelayResult { RELAY_COMPLETE, RELAY_INCOMPLETE, RELAY_NO_RESPONSE };
+    enum ContinueResult { CONTINUE_SEND_BODY, CONTINUE_ANSWERED, CONTINUE_FAILED };
+
+    // A forwarded request head as pieces pointing into the parsed request, written with one
+    // sendmsg. The request must stay unchanged while the head is in use
+    struct RequestHead {
+        iovec pieces[MAX_HEAD_PIECES];
+        size_t count;
+        size_t length;
+    };
+
+    void sendErrorResponse(int clientSocket, int statusCode, const std::string& statusText,
+                           RequestTrace* trace = nullptr);
+    void releaseConnection(const std::string& host, const std::string& port, int socket, bool reusable);
+    RelayResult relayResponse(HttpRequest& req, const std::string& port, int serverSocket, int clientSocket,
+                              std::chrono::steady_clock::time_point sent, std::shared_ptr<Logger> logger,
+                              std::string* captured = nullptr, size_t captureLimit = 0, bool retryable = false,
+                              ResponseFramer* parsed = nullptr, bool reusable = true);
+    ContinueResult awaitContinue(const HttpRequest& req, int serverSocket, int clientSocket,
+                                 std::shared_ptr<Logger> logger);
+    static bool expectsContinue(const HttpRequest& req);
+    int hedge(const HttpRequest& req, const RequestHead& head, int serverSocket, bool& reused,
+              std::chrono::steady_clock::time_point& sent, std::shared_ptr<Logger> logger);
+    int sendRequest(const std::string& host, const std::string& port, const RequestHead& head,
+                    ConnectMode mode, bool& reused, bool& sendFailed, RequestTrace* trace = nullptr);
+    void noteRetry(const HttpRequest& req, std::shared_ptr<Logger> logger);
+    static bool isIdempotent(const std::string& method);
+    bool relayRequestBody(HttpRequest& req, ResponseFramer& body, int clientSocket, int serverSocket,
+                          std::shared_ptr<Logger> logger);
+    static bool sendHead(int socket, const RequestHead& head);
+    static void addPiece(RequestHead& head, const char* data, size_t length);
+    static bool buildForwardRequest(const HttpRequest& req, RequestHead& head, bool chunkedBody = false);
+    std::shared_ptr<NegativeCache> negativeCache;
+    std::shared_ptr<ConnectionPool> pool;
+    std::shared_ptr<Dialer> dialer;
+    std::shared_ptr<Preconnector> preconnector;
+    std::shared_ptr<HealthTracker> health;
+    std::shared_ptr<TimerService> timers;
+    std::shared_ptr<HedgePolicy> hedging;
+    std::shared_ptr<OriginLimiter> limiter;
+    UploadPolicy uploads;
+    std::atomic<uint64_t> retries;
+    std::atomic<uint64_t> continued;
+    std::atomic<uint64_t> continuedLocally;
+    std::atomic<uint64_t> refusedUploads;
+    int connectToServer(const std::string& host, const std::string& port, ConnectMode mode = POOLED,
+                        bool* reused = nullptr, RequestTrace* trace = nullptr, int cancelFd = -1);
+    void recordResponse(const std::string& host, const std::string& port,
+                        std::chrono::steady_clock::time_point sent, int status);
+    void recordConnectFailure(const std::string& host, const std::string& port);
 };
\ No newline at end of file
@@ -0,0 +1,66 @@
+#include "NegativeCache.h"
+
+NegativeCache::NegativeCache(std::chrono::seconds dnsTtl, std::chrono::seconds connectTtl, size_t maxEntries)
+    : dnsTtl(dnsTtl), connectTtl(connectTtl), maxEntries(maxEntries) {}
+
+/**
+ * @brief: Whether host (any port) failed DNS or host:port failed to connect within the TTL
+ */
+bool NegativeCache::isKnownBad(const std::string& host, const std::string& port, Reason* reason) {
+    std::lock_guard<std::mutex> lock(negativeMutex);
+    return lookup(host, reason) || lookup(host + ":" + port, reason);
+}
+
+// DNS failures are remembered per host, they do not depend on the port
+void NegativeCache::recordDnsFailure(const std::string& host) {
+    std::lock_guard<std::mutex> lock(negativeMutex);
+    record(host, DNS_FAILURE, dnsTtl);
+}
+
+void NegativeCache::recordConnectFailure(const std::string& host, const std::string& port) {
+    std::lock_guard<std::mutex> lock(negativeMutex);
+    record(host + ":" + port, CONNECT_FAILURE, connectTtl);
+}
+
+size_t NegativeCache::size() {
+    std::lock_guard<std::mutex> lock(negativeMutex);
+    return entries.size();
+}
+
+// Caller must hold negativeMutex
+bool NegativeCache::lookup(const std::string& key, Reason* reason) {
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        return false;
+    }
+    if (it->second.expiry <= std::chrono::steady_clock::now()) {
+        entries.erase(it);
+        return false;
+    }
+    if (reason != nullptr) {
+        *reason = it->second.reason;
+    }
+    return true;
+}
+
+// Caller must hold negativeMutex
+void NegativeCache::record(const std::string& key, Reason reason, std::chrono::seconds ttl) {
+    auto now = std::chrono::steady_clock::now();
+    if (entries.size() >= maxEntries) {
+        // Make room by dropping whatever already expired, never grow past the cap
+        for (auto it = entries.begin(); it != entries.end();) {
+            if (it->second.expiry <= now) {
+                it = entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (entries.size() >= maxEntries) {
+            return;
+        }
+    }
+    Entry entry;
+    entry.expiry = now + ttl;
+    entry.reason = reason;
+    entries[key] = entry;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+
+/**
+ * Short-lived memory of upstream destinations that just failed to resolve or connect,
+ * so repeated requests to a dead host fail fast instead of waiting out the timeout again.
+ */
+class NegativeCache {
+public:
+    enum Reason {
+        DNS_FAILURE,
+        CONNECT_FAILURE
+    };
+
+private:
+    struct Entry {
+        std::chrono::steady_clock::time_point expiry;
+        Reason reason;
+    };
+
+    std::unordered_map<std::string, Entry> entries;
+    std::mutex negativeMutex;
+    std::chrono::seconds dnsTtl;
+    std::chrono::seconds connectTtl;
+    size_t maxEntries;
+    void record(const std::string& key, Reason reason, std::chrono::seconds ttl);
+    bool lookup(const std::string& key, Reason* reason);
+
+public:
+    NegativeCache(std::chrono::seconds dnsTtl = std::chrono::seconds(30),
+                  std::chrono::seconds connectTtl = std::chrono::seconds(10),
+                  size_t maxEntries = 10000);
+
+    bool isKnownBad(const std::string& host, const std::string& port, Reason* reason = nullptr);
+    void recordDnsFailure(const std::string& host);
+    void recordConnectFailure(const std::string& host, const std::string& port);
+    size_t size();
+};
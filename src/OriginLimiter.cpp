@@ -0,0 +1,126 @@
+#include "OriginLimiter.h"
+
+OriginLimiter::OriginLimiter(size_t maxPerOrigin, size_t maxTotal, unsigned quantum)
+    : maxPerOrigin(maxPerOrigin), maxTotal(maxTotal), quantum(quantum), inFlight(0), stats() {}
+
+/**
+ * @brief: Take a slot for one exchange with host:port, waiting at most timeout for it.
+ *         cost is what the exchange is charged against the origin's deficit.
+ */
+bool OriginLimiter::acquire(const std::string& host, const std::string& port, std::chrono::milliseconds timeout,
+                            unsigned cost) {
+    std::unique_lock<std::mutex> lock(limiterMutex);
+    std::string key = host + ":" + port;
+    Origin& origin = origins[key];
+    // Nobody ahead of us and room on both limits: no need to queue
+    if (origin.waiters.empty() && origin.inFlight < maxPerOrigin && inFlight < maxTotal) {
+        ++origin.inFlight;
+        ++inFlight;
+        ++stats.immediate;
+        return true;
+    }
+
+    Waiter waiter;
+    waiter.cost = cost;
+    waiter.granted = false;
+    origin.waiters.push_back(&waiter);
+    if (!origin.scheduled) {
+        origin.scheduled = true;
+        roundRobin.push_back(key);
+    }
+    ++stats.queued;
+    auto begin = Clock::now();
+    dispatchLocked();
+    bool granted = waiter.ready.wait_for(lock, timeout, [&waiter]() { return waiter.granted; });
+    uint64_t waited = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - begin).count();
+    if (waited > stats.maxWaitMicros) {
+        stats.maxWaitMicros = waited;
+    }
+    if (!granted) {
+        // Still queued, dispatch never touched us
+        Origin& current = origins[key];
+        for (auto it = current.waiters.begin(); it != current.waiters.end(); ++it) {
+            if (*it == &waiter) {
+                current.waiters.erase(it);
+                break;
+            }
+        }
+        ++stats.timedOut;
+    }
+    return granted;
+}
+
+void OriginLimiter::release(const std::string& host, const std::string& port) {
+    std::lock_guard<std::mutex> lock(limiterMutex);
+    auto it = origins.find(host + ":" + port);
+    if (it == origins.end() || it->second.inFlight == 0) {
+        return;
+    }
+    --it->second.inFlight;
+    --inFlight;
+    if (it->second.inFlight == 0 && it->second.waiters.empty() && !it->second.scheduled) {
+        origins.erase(it);
+    }
+    dispatchLocked();
+}
+
+OriginLimiter::Stats OriginLimiter::getStats() {
+    std::lock_guard<std::mutex> lock(limiterMutex);
+    Stats copy = stats;
+    copy.inFlight = inFlight;
+    copy.waiting = 0;
+    for (const auto& origin : origins) {
+        copy.waiting += origin.second.waiters.size();
+    }
+    return copy;
+}
+
+/**
+ * @brief: Hand free slots to waiting origins. Each visit adds quantum to an origin's deficit,
+ *         and it is served while its head waiter's cost fits. An origin at its own limit is
+ *         passed over. Stops when a full round grants nothing. Caller must hold limiterMutex.
+ */
+void OriginLimiter::dispatchLocked() {
+    size_t idleVisits = 0;
+    while (inFlight < maxTotal && !roundRobin.empty() && idleVisits < roundRobin.size()) {
+        std::string key = roundRobin.front();
+        roundRobin.pop_front();
+        Origin& origin = origins[key];
+        if (origin.waiters.empty()) {
+            // Everyone in line timed out
+            origin.scheduled = false;
+            origin.deficit = 0;
+            if (origin.inFlight == 0) {
+                origins.erase(key);
+            }
+            continue;
+        }
+        bool served = false;
+        if (origin.inFlight < maxPerOrigin) {
+            origin.deficit += quantum;
+            while (!origin.waiters.empty() && origin.waiters.front()->cost <= origin.deficit &&
+                   origin.inFlight < maxPerOrigin && inFlight < maxTotal) {
+                origin.deficit -= origin.waiters.front()->cost;
+                grantLocked(origin);
+                served = true;
+            }
+        }
+        idleVisits = served ? 0 : idleVisits + 1;
+        if (origin.waiters.empty()) {
+            origin.scheduled = false;
+            origin.deficit = 0;
+        } else {
+            roundRobin.push_back(key);
+        }
+    }
+}
+
+// Caller must hold limiterMutex
+void OriginLimiter::grantLocked(Origin& origin) {
+    Waiter* waiter = origin.waiters.front();
+    origin.waiters.pop_front();
+    ++origin.inFlight;
+    ++inFlight;
+    waiter->granted = true;
+    waiter->ready.notify_one();
+}
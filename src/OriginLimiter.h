@@ -0,0 +1,85 @@
+#pragma once
+#include <string>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+/**
+ * Bounds concurrent upstream exchanges, per origin and in total. Requests over the limit
+ * wait in a per-origin FIFO. Freed slots go to the waiting origins in deficit round-robin
+ * order, so a hot or slow origin cannot starve the others. A request that waits longer
+ * than its timeout gives up.
+ */
+class OriginLimiter {
+public:
+    struct Stats {
+        uint64_t immediate;      // slots granted without waiting
+        uint64_t queued;         // requests that had to wait
+        uint64_t timedOut;       // waits that gave up
+        uint64_t maxWaitMicros;
+        size_t waiting;
+        size_t inFlight;
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    struct Waiter {
+        unsigned cost;
+        bool granted;
+        std::condition_variable ready;
+    };
+    struct Origin {
+        size_t inFlight;
+        unsigned deficit;
+        std::deque<Waiter*> waiters;
+        bool scheduled;          // present in the round-robin list
+    };
+
+    std::unordered_map<std::string, Origin> origins;
+    std::list<std::string> roundRobin;   // origins with waiters, in service order
+    std::mutex limiterMutex;
+    size_t maxPerOrigin;
+    size_t maxTotal;
+    unsigned quantum;
+    size_t inFlight;
+    Stats stats;
+
+    void dispatchLocked();
+    void grantLocked(Origin& origin);
+
+public:
+    OriginLimiter(size_t maxPerOrigin = 16, size_t maxTotal = 256, unsigned quantum = 1);
+
+    bool acquire(const std::string& host, const std::string& port, std::chrono::milliseconds timeout,
+                 unsigned cost = 1);
+    void release(const std::string& host, const std::string& port);
+    Stats getStats();
+
+    // Holds one slot for the lifetime of an exchange. A null limiter admits everything
+    class Slot {
+    private:
+        std::shared_ptr<OriginLimiter> limiter;
+        std::string host;
+        std::string port;
+        bool held;
+
+    public:
+        Slot(std::shared_ptr<OriginLimiter> limiter, const std::string& host, const std::string& port,
+             std::chrono::milliseconds timeout)
+            : limiter(limiter), host(host), port(port),
+              held(!limiter || limiter->acquire(host, port, timeout)) {}
+        ~Slot() {
+            if (limiter && held) {
+                limiter->release(host, port);
+            }
+        }
+        Slot(const Slot&) = delete;
+        Slot& operator=(const Slot&) = delete;
+        bool admitted() const { return held; }
+    };
+};
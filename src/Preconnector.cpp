@@ -0,0 +1,153 @@
+#include "Preconnector.h"
+#include <cmath>
+
+// Origins without traffic for this long are forgotten
+#define DEMAND_TTL_SECONDS 300
+
+Preconnector::Preconnector(std::shared_ptr<ConnectionPool> pool, std::shared_ptr<Dialer> dialer,
+                           std::shared_ptr<NegativeCache> negativeCache, std::shared_ptr<HealthTracker> health,
+                           size_t maxWarmPerOrigin, size_t maxPending, std::chrono::seconds halfLife, size_t threads)
+    : pool(pool), dialer(dialer), negativeCache(negativeCache), health(health), maxWarmPerOrigin(maxWarmPerOrigin), maxPending(maxPending),
+      halfLife(halfLife), totalPending(0), stopping(false), stats() {
+    for (size_t i = 0; i < threads; ++i) {
+        workers.emplace_back(&Preconnector::workerLoop, this);
+    }
+}
+
+Preconnector::~Preconnector() {
+    {
+        std::lock_guard<std::mutex> lock(preconnectMutex);
+        stopping = true;
+    }
+    queueReady.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+/**
+ * @brief: A request got a connection to host:port. Update the demand estimate and queue
+ *         speculative dials for the connections it predicts the next requests will need.
+ */
+void Preconnector::onAcquire(const std::string& host, const std::string& port, bool pooled) {
+    size_t idle = pool->idleFor(host, port);
+    std::lock_guard<std::mutex> lock(preconnectMutex);
+    Clock::time_point now = Clock::now();
+    pruneLocked(now);
+    Demand& origin = demand[host + ":" + port];
+    decayLocked(origin, now);
+    ++origin.inFlight;
+    origin.predicted = std::max(origin.predicted, static_cast<double>(origin.inFlight));
+
+    size_t predicted = static_cast<size_t>(std::ceil(origin.predicted));
+    size_t target = predicted > origin.inFlight ? predicted - origin.inFlight : 0;
+    // The last pooled connection of an origin that reuses connections gets a successor
+    if (pooled && idle == 0) {
+        target = std::max<size_t>(target, 1);
+    }
+    target = std::min(target, maxWarmPerOrigin);
+    while (idle + origin.pending < target && totalPending < maxPending) {
+        ++origin.pending;
+        ++totalPending;
+        queue.emplace_back(host, port);
+        queueReady.notify_one();
+    }
+}
+
+void Preconnector::onRelease(const std::string& host, const std::string& port) {
+    std::lock_guard<std::mutex> lock(preconnectMutex);
+    auto it = demand.find(host + ":" + port);
+    if (it != demand.end() && it->second.inFlight > 0) {
+        decayLocked(it->second, Clock::now());
+        --it->second.inFlight;
+    }
+}
+
+Preconnector::Stats Preconnector::getStats() {
+    std::lock_guard<std::mutex> lock(preconnectMutex);
+    return stats;
+}
+
+// Halve the predicted peak every halfLife, never below what is in flight now
+void Preconnector::decayLocked(Demand& origin, Clock::time_point now) {
+    double elapsed = std::chrono::duration<double>(now - origin.updated).count();
+    origin.updated = now;
+    origin.predicted *= std::exp2(-elapsed / halfLife.count());
+    origin.predicted = std::max(origin.predicted, static_cast<double>(origin.inFlight));
+}
+
+// Caller must hold preconnectMutex
+void Preconnector::pruneLocked(Clock::time_point now) {
+    for (auto it = demand.begin(); it != demand.end();) {
+        if (it->second.inFlight == 0 && it->second.pending == 0 &&
+            now - it->second.updated >= std::chrono::seconds(DEMAND_TTL_SECONDS)) {
+            it = demand.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+/**
+ * @brief: Open one speculative connection. A failure counts against the origin the same
+ *         way a request's own dial does. A success says nothing about its responses, so
+ *         it is not fed to the health tracker.
+ */
+int Preconnector::dial(const std::string& host, const std::string& port) {
+    Dialer::Result result;
+    int fd = dialer->dial(host, port, result);
+    if (fd >= 0) {
+        return fd;
+    }
+    if (health) {
+        health->recordFailure(host, port);
+    }
+    if (negativeCache) {
+        if (result == Dialer::DNS_FAILURE) {
+            negativeCache->recordDnsFailure(host);
+        } else {
+            negativeCache->recordConnectFailure(host, port);
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief: Background thread: dial queued origins and park the connections in the pool
+ */
+void Preconnector::workerLoop() {
+    while (true) {
+        std::pair<std::string, std::string> origin;
+        {
+            std::unique_lock<std::mutex> lock(preconnectMutex);
+            queueReady.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (stopping) {
+                return;
+            }
+            origin = queue.front();
+            queue.pop_front();
+        }
+
+        // Origins with an open circuit or a fresh failure are left alone, requests will probe them
+        bool failing = (health && !health->healthy(origin.first, origin.second)) ||
+                       (negativeCache && negativeCache->isKnownBad(origin.first, origin.second));
+        int fd = failing ? -1 : dial(origin.first, origin.second);
+        if (fd >= 0) {
+            pool->release(origin.first, origin.second, fd, true);
+        }
+
+        std::lock_guard<std::mutex> lock(preconnectMutex);
+        if (fd >= 0) {
+            ++stats.opened;
+        } else if (failing) {
+            ++stats.skipped;
+        } else {
+            ++stats.failed;
+        }
+        --totalPending;
+        auto it = demand.find(origin.first + ":" + origin.second);
+        if (it != demand.end()) {
+            --it->second.pending;
+        }
+    }
+}
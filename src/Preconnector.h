@@ -0,0 +1,71 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include "ConnectionPool.h"
+#include "Dialer.h"
+#include "NegativeCache.h"
+#include "HealthTracker.h"
+
+/**
+ * Keeps upstream connections warm ahead of demand. For every origin it follows how many
+ * requests hold a connection at once, with a peak that decays over time, and tops the
+ * idle pool up to that prediction from background threads. Handing out the last pooled
+ * connection of a busy origin opens a replacement right away.
+ */
+class Preconnector {
+public:
+    struct Stats {
+        uint64_t opened;   // speculative connections added to the pool
+        uint64_t failed;   // speculative dials that did not connect
+        uint64_t skipped;  // queued dials dropped because the origin was known to be failing
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    struct Demand {
+        size_t inFlight;     // requests holding a connection to this origin
+        double predicted;    // decayed peak of inFlight
+        size_t pending;      // speculative dials queued or running
+        Clock::time_point updated;
+    };
+
+    std::shared_ptr<ConnectionPool> pool;
+    std::shared_ptr<Dialer> dialer;
+    std::shared_ptr<NegativeCache> negativeCache;
+    std::shared_ptr<HealthTracker> health;
+    std::unordered_map<std::string, Demand> demand;
+    std::deque<std::pair<std::string, std::string>> queue;
+    std::vector<std::thread> workers;
+    std::mutex preconnectMutex;
+    std::condition_variable queueReady;
+    size_t maxWarmPerOrigin;
+    size_t maxPending;
+    std::chrono::seconds halfLife;
+    size_t totalPending;
+    bool stopping;
+    Stats stats;
+
+    void workerLoop();
+    void decayLocked(Demand& origin, Clock::time_point now);
+    void pruneLocked(Clock::time_point now);
+    int dial(const std::string& host, const std::string& port);
+
+public:
+    Preconnector(std::shared_ptr<ConnectionPool> pool, std::shared_ptr<Dialer> dialer,
+                 std::shared_ptr<NegativeCache> negativeCache = nullptr, std::shared_ptr<HealthTracker> health = nullptr,
+                 size_t maxWarmPerOrigin = 4, size_t maxPending = 16,
+                 std::chrono::seconds halfLife = std::chrono::seconds(10), size_t threads = 2);
+    ~Preconnector();
+
+    void onAcquire(const std::string& host, const std::string& port, bool pooled);
+    void onRelease(const std::string& host, const std::string& port);
+    Stats getStats();
+};
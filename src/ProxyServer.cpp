@@ -8,21 +8,37 @@
 #include <thread>
 #include <vector>
 #include <stdexcept>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
 
 #include "ProxyServer.h"
 #include "Logger.h"
 #include "CacheManager.h"
 #include "RequestHandler.h"
 #include "ConnectionHandler.h"
+#include "MessageForwarder.h"
 
-#define BUFFER_SIZE 4096  // 4 KB buffer
 
-
-ProxyServer::ProxyServer(int port) : port(port), running(false) {
-    logger = std::make_shared<Logger>("logs/proxy.log");
-    cacheManager = std::make_shared<CacheManager>();
-    auto requestHandler = std::make_shared<RequestHandler>(cacheManager, logger);
-    connectionHandler = std::make_unique<ConnectionHandler>(requestHandler, logger);
+ProxyServer::ProxyServer(int port, const PhaseTimeouts& timeouts, const HedgeConfig& hedging, size_t maxPerOrigin,
+                         size_t maxTotal, const UploadPolicy& uploads, bool binaryLog)
+    : port(port), running(false) {
+    logger = binaryLog ? std::make_shared<Logger>("logs/proxy.bin", Logger::BINARY)
+                       : std::make_shared<Logger>("logs/proxy.log");
+    cacheManager = std::make_shared<CacheManager>(64 * 1024 * 1024, 0, true);
+    negativeCache = std::make_shared<NegativeCache>();
+    connectionPool = std::make_shared<ConnectionPool>();
+    timers = std::make_shared<TimerService>(timeouts);
+    resolver = std::make_shared<DnsResolver>();
+    dialer = std::make_shared<Dialer>(resolver, std::chrono::milliseconds(250), timeouts.connect);
+    healthTracker = std::make_shared<HealthTracker>();
+    preconnector = std::make_shared<Preconnector>(connectionPool, dialer, negativeCache, healthTracker);
+    hedgePolicy = std::make_shared<HedgePolicy>(hedging, healthTracker);
+    originLimiter = std::make_shared<OriginLimiter>(maxPerOrigin, maxTotal);
+    forwarder = std::make_shared<MessageForwarder>(negativeCache, connectionPool, dialer, preconnector, healthTracker,
+                                                   timers, hedgePolicy, originLimiter, uploads);
+    requestHandler = std::make_shared<RequestHandler>(cacheManager, logger, forwarder);
+    connectionHandler = std::make_unique<ConnectionHandler>(requestHandler, logger, timers);
 }
 
 ProxyServer::~ProxyServer() {
@@ -52,4 +68,109 @@ void ProxyServer::stop() {
 
 bool ProxyServer::isRunning() const {
     return running;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief: Restore the cache from a snapshot file, if there is one
+ */
+bool ProxyServer::loadSnapshot(const std::string& path) {
+    auto begin = std::chrono::steady_clock::now();
+    if (!cacheManager->loadSnapshot(path)) {
+        logger->log(Logger::WARNING, "No usable cache snapshot at " + path);
+        return false;
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin);
+    logger->log(Logger::INFO, "Restored " + std::to_string(cacheManager->size()) + " cache entries from " + path +
+                " in " + std::to_string(elapsed.count()) + " ms");
+    return true;
+}
+
+bool ProxyServer::saveSnapshot(const std::string& path) {
+    if (!cacheManager->saveSnapshot(path)) {
+        logger->log(Logger::ERROR, "Failed to write cache snapshot to " + path);
+        return false;
+    }
+    logger->log(Logger::INFO, "Wrote cache snapshot with " + std::to_string(cacheManager->size()) + " entries to " + path);
+    return true;
+}
+
+/**
+ * @brief: Prefetch a list of URLs into the cache with at most concurrency requests
+ *         in flight. Blocks until the list is done, so call it before start().
+ */
+void ProxyServer::warmCache(const std::vector<std::string>& urls, size_t concurrency) {
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> fetched(0);
+    std::vector<std::thread> workers;
+    size_t count = std::max<size_t>(1, std::min(concurrency, urls.size()));
+    for (size_t i = 0; i < count; ++i) {
+        workers.emplace_back([&]() {
+            size_t index;
+            while ((index = next++) < urls.size()) {
+                if (requestHandler->prefetch(urls[index])) {
+                    ++fetched;
+                } else {
+                    logger->log(Logger::WARNING, "Failed to prefetch " + urls[index]);
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    logger->log(Logger::INFO, "Warmed cache with " + std::to_string(fetched.load()) + "/" +
+                std::to_string(urls.size()) + " URLs");
+}
+
+/**
+ * @brief: Write cache, upstream pool, resolver, dialer, pre-connect, origin health, timer,
+ *         forwarding and origin limit counters to the log
+ */
+void ProxyServer::logStats() {
+    ConnectionPool::Stats pool = connectionPool->getStats();
+    DnsResolver::Stats dns = resolver->getStats();
+    Dialer::Stats dial = dialer->getStats();
+    Preconnector::Stats preconnect = preconnector->getStats();
+    HealthTracker::Stats health = healthTracker->getStats();
+    TimerService::Stats timer = timers->getStats();
+    MessageForwarder::Stats forwarding = forwarder->getStats();
+    HedgePolicy::Stats hedges = hedgePolicy->getStats();
+    OriginLimiter::Stats limits = originLimiter->getStats();
+    Logger::Stats logging = logger->getStats();
+    uint64_t acquisitions = pool.hits + pool.misses;
+    logger->log(Logger::INFO, "Cache: " + std::to_string(cacheManager->size()) + " entries, " +
+                std::to_string(cacheManager->bytesUsed()) + " bytes, " +
+                std::to_string(cacheManager->bytesDeduplicated()) + " bytes deduplicated");
+    logger->log(Logger::INFO, "Upstream pool: " + std::to_string(pool.hits) + "/" + std::to_string(acquisitions) +
+                " hits, " + std::to_string(pool.idle) + " idle, " + std::to_string(pool.staleClosed) +
+                " stale closed, avg wait " + std::to_string(acquisitions ? pool.totalWaitMicros / acquisitions : 0) +
+                " us, max wait " + std::to_string(pool.maxWaitMicros) + " us");
+    logger->log(Logger::INFO, "DNS: " + std::to_string(dns.hits) + " hits, " + std::to_string(dns.misses) +
+                " misses, " + std::to_string(dns.coalesced) + " coalesced, " + std::to_string(dns.refreshes) +
+                " refreshes, " + std::to_string(dns.failures) + " failures");
+    logger->log(Logger::INFO, "Dialer: " + std::to_string(dial.dials) + " dials, " + std::to_string(dial.attempts) +
+                " attempts, " + std::to_string(dial.ipv6Wins) + " IPv6 / " + std::to_string(dial.ipv4Wins) +
+                " IPv4 wins, " + std::to_string(dial.addressFailures) + " failed addresses");
+    logger->log(Logger::INFO, "Pre-connect: " + std::to_string(preconnect.opened) + " opened, " +
+                std::to_string(pool.preconnectUsed) + " used, " + std::to_string(pool.preconnectWasted) + " wasted, " +
+                std::to_string(preconnect.failed) + " failed, " + std::to_string(preconnect.skipped) + " skipped");
+    logger->log(Logger::INFO, "Origin health: " + std::to_string(health.origins) + " origins, " +
+                std::to_string(health.openCircuits) + " open circuits, " + std::to_string(health.trips) + " trips, " +
+                std::to_string(health.rejected) + " rejected, " + std::to_string(health.probes) + " probes");
+    logger->log(Logger::INFO, "Timers: " + std::to_string(timer.armed) + " armed, " + std::to_string(timer.fired) +
+                " fired, " + std::to_string(timer.active) + " active");
+    logger->log(Logger::INFO, "Forwarding: " + std::to_string(forwarding.retries) + " retries on fresh connections");
+    logger->log(Logger::INFO, "Uploads: " + std::to_string(forwarding.continued) + " continued by the origin, " +
+                std::to_string(forwarding.continuedLocally) + " by the proxy, " +
+                std::to_string(forwarding.refusedUploads) + " refused before the body");
+    logger->log(Logger::INFO, "Hedging: " + std::to_string(hedges.hedged) + "/" + std::to_string(hedges.eligible) +
+                " GETs hedged, " + std::to_string(hedges.wins) + " won by the hedge, " + std::to_string(hedges.denied) +
+                " denied by budget");
+    logger->log(Logger::INFO, "Origin limits: " + std::to_string(limits.inFlight) + " in flight, " +
+                std::to_string(limits.waiting) + " waiting, " + std::to_string(limits.queued) + " queued, " +
+                std::to_string(limits.timedOut) + " timed out, max wait " + std::to_string(limits.maxWaitMicros) + " us");
+    logger->log(Logger::INFO, "Logging: " + std::to_string(logging.written) + " records written, " +
+                std::to_string(logging.dropped) + " dropped, " + std::to_string(logging.interned) + " strings interned");
+    // The caller may exit right after, so the lines have to reach the file now
+    logger->flush();
+}
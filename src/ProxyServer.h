@@ -1,8 +1,21 @@
 #pragma once
 #include <string>
 #include <memory>
+#include <vector>
 #include "ConnectionHandler.h"
 #include "CacheManager.h"
+#include "NegativeCache.h"
+#include "ConnectionPool.h"
+#include "DnsResolver.h"
+#include "Dialer.h"
+#include "Preconnector.h"
+#include "HealthTracker.h"
+#include "TimerService.h"
+#include "HedgePolicy.h"
+#include "OriginLimiter.h"
+#include "UploadPolicy.h"
+
+class MessageForwarder;
 #include "Logger.h"
 
 class ProxyServer {
@@ -11,13 +24,31 @@ private:
     bool running;
     std::unique_ptr<ConnectionHandler> connectionHandler;
     std::shared_ptr<CacheManager> cacheManager;
+    std::shared_ptr<NegativeCache> negativeCache;
+    std::shared_ptr<ConnectionPool> connectionPool;
+    std::shared_ptr<DnsResolver> resolver;
+    std::shared_ptr<Dialer> dialer;
+    std::shared_ptr<Preconnector> preconnector;
+    std::shared_ptr<HealthTracker> healthTracker;
+    std::shared_ptr<TimerService> timers;
+    std::shared_ptr<HedgePolicy> hedgePolicy;
+    std::shared_ptr<OriginLimiter> originLimiter;
+    std::shared_ptr<MessageForwarder> forwarder;
+    std::shared_ptr<RequestHandler> requestHandler;
     std::shared_ptr<Logger> logger;
 
 public:
-    ProxyServer(int port = 8080);
+    ProxyServer(int port = 8080, const PhaseTimeouts& timeouts = PhaseTimeouts(),
+                const HedgeConfig& hedging = HedgeConfig(), size_t maxPerOrigin = 16, size_t maxTotal = 256,
+                const UploadPolicy& uploads = UploadPolicy(), bool binaryLog = false);
     ~ProxyServer();
     
     void start();
     void stop();
     bool isRunning() const;
+
+    bool loadSnapshot(const std::string& path);
+    bool saveSnapshot(const std::string& path);
+    void logStats();
+    void warmCache(const std::vector<std::string>& urls, size_t concurrency);
 }; 
\ No newline at end of file
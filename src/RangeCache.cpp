@@ -0,0 +1,407 @@
+#include "RangeCache.h"
+#include "MessageForwarder.h"
+#include <sys/socket.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
+
+// Segments fetched with one upstream request and held in memory at once, at most
+#define MAX_RUN_SEGMENTS 4
+// Room for the response head on top of the segments of a run
+#define MAX_RUN_HEAD_SIZE 65536
+// How long an origin that ignores ranges or an uncacheable object is left alone, and how many are kept
+#define BYPASS_SECONDS 600
+#define MAX_BYPASS_ENTRIES 4096
+
+RangeCache::RangeCache(std::shared_ptr<CacheManager> cache, std::shared_ptr<Logger> logger,
+                       std::shared_ptr<MessageForwarder> forwarder)
+    : cacheManager(cache), logger(logger), forwarder(forwarder) {}
+
+/**
+ * @brief: Answer a single-range GET from cached data, fetching missing segments upstream.
+ *         Large ranges are loaded and sent MAX_RUN_SEGMENTS segments at a time, so memory
+ *         use does not grow with the range. RANGE_DECLINED means nothing was sent and the
+ *         request should be forwarded unchanged; RANGE_CLOSE that the response was cut
+ *         short or ran until close, and the connection cannot carry another request.
+ */
+RangeCache::ServeResult RangeCache::serve(HttpRequest& req, int clientSocket, int clientId) {
+    const std::string* range = req.headers.find(HeaderMap::RANGE);
+    if (!range || req.headers.has(HeaderMap::IF_RANGE)) {
+        return RANGE_DECLINED;
+    }
+    size_t start = 0;
+    size_t end = 0;
+    bool openEnded = false;
+    if (!parseRange(*range, start, end, openEnded)) {
+        return RANGE_DECLINED;
+    }
+
+    std::string key = req.method + " " + req.url;
+    // fetchRun downgrades this when part of the range has to come from the origin
+    req.trace.cache = CACHE_HIT;
+    ObjectInfo info;
+    info.length = 0;
+    SegmentMap segments;
+
+    // A fully cached identity response can be sliced directly
+    std::shared_ptr<CacheEntry> whole = cacheManager->get(key);
+    if (whole && !whole->requiresValidation && cachedStatus(*whole) != 200) {
+        // A cached 404 or 410 answers any range of the URL, the caller sends it as it is
+        return RANGE_DECLINED;
+    }
+    if (whole && !whole->requiresValidation && !whole->gzipped && whole->body &&
+        HttpParser::findHeader(whole->headers, "Transfer-Encoding").empty()) {
+        info.headers = stripEntityHeaders(whole->headers);
+        info.length = whole->body->size();
+        segments[0] = whole->body;
+        if (start >= info.length) {
+            return sendUnsatisfiable(clientSocket, info, req.trace) ? RANGE_SERVED : RANGE_CLOSE;
+        }
+        if (openEnded || end >= info.length) {
+            end = info.length - 1;
+        }
+        bool sent = sendRangeHead(clientSocket, info, start, end, req.trace) &&
+                    sendPieces(clientSocket, segments, start, end, req.trace);
+        return sent ? RANGE_SERVED : RANGE_CLOSE;
+    }
+
+    // Nothing would be stored, aligning the range to segments only costs the origin more
+    if (bypassed(req.host + ":" + req.port) || bypassed(key)) {
+        return RANGE_DECLINED;
+    }
+
+    // For an open-ended range the first segment tells us how long the object is
+    size_t first = start / SEGMENT_SIZE;
+    size_t windowEnd = openEnded ? first : std::min(end / SEGMENT_SIZE, first + MAX_RUN_SEGMENTS - 1);
+    // Until the head is sent an origin's other answer can go to the client instead
+    ServeResult relayed = RANGE_DECLINED;
+    if (!loadSegments(req, key, first, windowEnd, segments, info, clientSocket, &relayed)) {
+        return relayed;
+    }
+    if (start >= info.length) {
+        return sendUnsatisfiable(clientSocket, info, req.trace) ? RANGE_SERVED : RANGE_CLOSE;
+    }
+    if (openEnded || end >= info.length) {
+        end = info.length - 1;
+    }
+    // Load the rest of the first window while the request can still be declined
+    windowEnd = std::min(end / SEGMENT_SIZE, first + MAX_RUN_SEGMENTS - 1);
+    if (!loadSegments(req, key, first, windowEnd, segments, info, clientSocket, &relayed)) {
+        return relayed;
+    }
+    logger->log("serving bytes " + std::to_string(start) + "-" + std::to_string(end) + " from cached segments", clientId);
+    if (!sendRangeHead(clientSocket, info, start, end, req.trace)) {
+        return RANGE_CLOSE;
+    }
+    size_t last = end / SEGMENT_SIZE;
+    while (true) {
+        if (!sendPieces(clientSocket, segments, start, end, req.trace)) {
+            return RANGE_CLOSE;
+        }
+        size_t next = std::min(windowEnd, last) + 1;
+        if (next > last) {
+            return RANGE_SERVED;
+        }
+        windowEnd = std::min(last, next + MAX_RUN_SEGMENTS - 1);
+        segments.clear();
+        if (!loadSegments(req, key, next, windowEnd, segments, info)) {
+            // The head promised the whole range, only closing tells the client it is short
+            logger->log("could not load bytes from " + std::to_string(next * SEGMENT_SIZE) + ", closing", clientId);
+            return RANGE_CLOSE;
+        }
+    }
+}
+
+/**
+ * @brief: Parse "bytes=start-end" or "bytes=start-". Multiple and suffix ranges are left to the origin.
+ */
+bool RangeCache::parseRange(const std::string& value, size_t& start, size_t& end, bool& openEnded) {
+    if (value.compare(0, 6, "bytes=") != 0 || value.find(',') != std::string::npos) {
+        return false;
+    }
+    size_t dash = value.find('-', 6);
+    if (dash == std::string::npos || dash == 6) {
+        return false;
+    }
+    try {
+        start = std::stoul(value.substr(6, dash - 6));
+        openEnded = dash + 1 == value.size();
+        if (!openEnded) {
+            end = std::stoul(value.substr(dash + 1));
+        }
+    } catch (const std::exception& e) {
+        return false;
+    }
+    return openEnded || end >= start;
+}
+
+/**
+ * @brief: Make segments first..last available, from the cache where possible and with
+ *         one upstream request per run of at most MAX_RUN_SEGMENTS missing segments otherwise.
+ *         With relaySocket set, an upstream answer that is not a 206 is sent there and
+ *         relayed says how that went, see fetchRun.
+ */
+bool RangeCache::loadSegments(HttpRequest& req, const std::string& key, size_t first, size_t last,
+                              SegmentMap& segments, ObjectInfo& info, int relaySocket, ServeResult* relayed) {
+    size_t index = first;
+    while (index <= last) {
+        if (info.length > 0 && index * SEGMENT_SIZE >= info.length) {
+            break;  // past the end of the object
+        }
+        if (segments.count(index * SEGMENT_SIZE) > 0) {
+            ++index;
+            continue;
+        }
+        std::shared_ptr<CacheEntry> cached = cacheManager->getSegment(key, index);
+        if (cached) {
+            if (!sameObject(key, info, cached->headers, cached->objectLength)) {
+                return false;
+            }
+            segments[index * SEGMENT_SIZE] = cached->body;
+            ++index;
+            continue;
+        }
+        size_t runEnd = index;
+        while (runEnd < last && runEnd - index + 1 < MAX_RUN_SEGMENTS &&
+               segments.count((runEnd + 1) * SEGMENT_SIZE) == 0 && !cacheManager->getSegment(key, runEnd + 1)) {
+            ++runEnd;
+        }
+        if (!fetchRun(req, key, index, runEnd, segments, info, relaySocket, relayed)) {
+            return false;
+        }
+        index = runEnd + 1;
+    }
+    return true;
+}
+
+/**
+ * @brief: Fetch segments first..last with a single upstream Range request and split
+ *         the answer into SEGMENT_SIZE pieces, caching them when the origin allows it.
+ *         Any other answer is streamed to relaySocket when one is given, relayed is then
+ *         RANGE_SERVED or RANGE_CLOSE; without one it is dropped after its head. A 206
+ *         of the wrong size or framing is dropped either way.
+ */
+bool RangeCache::fetchRun(HttpRequest& req, const std::string& key, size_t first, size_t last,
+                          SegmentMap& segments, ObjectInfo& info, int relaySocket, ServeResult* relayed) {
+    size_t from = first * SEGMENT_SIZE;
+    size_t to = (last + 1) * SEGMENT_SIZE - 1;
+    if (info.length > 0 && to >= info.length) {
+        to = info.length - 1;
+    }
+    HttpRequest upstream = req;
+    upstream.headers.set("Range", "bytes=" + std::to_string(from) + "-" + std::to_string(to));
+    // A changed object then comes back whole instead of as a range of the new version
+    bool conditional = !info.validator.empty() && info.validator.compare(0, 2, "W/") != 0;
+    if (conditional) {
+        upstream.headers.set("If-Range", info.validator);
+    }
+
+    std::string response;
+    ResponseFramer parsed;
+    bool relaying = false;
+    bool fetched = forwarder->fetchResponse(upstream, response, logger, &parsed, 206,
+                                            MAX_RUN_SEGMENTS * SEGMENT_SIZE + MAX_RUN_HEAD_SIZE, relaySocket,
+                                            &relaying);
+    // The client's entry reports the upstream phases of the last fetch
+    req.trace.cache = CACHE_MISS;
+    req.trace.upstreamReused = upstream.trace.upstreamReused;
+    req.trace.dnsMicros = upstream.trace.dnsMicros;
+    req.trace.connectMicros = upstream.trace.connectMicros;
+    req.trace.ttfbMicros = upstream.trace.ttfbMicros;
+    req.trace.transferMicros = upstream.trace.transferMicros;
+    if (relaying) {
+        // The client asked for a range of this URL, the origin's own answer is as good
+        req.trace.status = upstream.trace.status;
+        req.trace.bytesOut += upstream.trace.bytesOut;
+        *relayed = fetched && parsed.mode() != ResponseFramer::UNTIL_CLOSE ? RANGE_SERVED : RANGE_CLOSE;
+    }
+    if (!fetched || relaying) {
+        if (conditional && parsed.headersComplete() && parsed.statusCode() == 200) {
+            cacheManager->removeSegments(key, info.length);
+        } else if (parsed.headersComplete() && parsed.statusCode() == 200) {
+            rememberBypass(req.host + ":" + req.port);   // the origin does not do ranges
+        }
+        return false;
+    }
+    const std::string& headerBlock = parsed.headers();
+    size_t headerEnd = parsed.headLength();
+
+    // Content-Range: bytes from-to/total
+    size_t rangeStart = 0;
+    size_t rangeEnd = 0;
+    size_t total = 0;
+    std::string contentRange(parsed.field(HeaderMap::CONTENT_RANGE));
+    if (sscanf(contentRange.c_str(), "bytes %zu-%zu/%zu", &rangeStart, &rangeEnd, &total) != 3 ||
+        rangeStart != from || rangeEnd < rangeStart || rangeEnd >= total) {
+        return false;
+    }
+    size_t bodyLength = response.size() - headerEnd;
+    // Only the last segment of the object may be short
+    if (bodyLength != rangeEnd - rangeStart + 1 || (rangeEnd != to && rangeEnd + 1 != total)) {
+        return false;
+    }
+
+    if (!sameObject(key, info, stripEntityHeaders(headerBlock), total)) {
+        return false;
+    }
+    std::string_view cacheControl = parsed.field(HeaderMap::CACHE_CONTROL);
+    // Without a validator a later change of the object could not be told apart
+    bool storable = !info.validator.empty() && cacheControl.find("no-store") == std::string_view::npos &&
+                    cacheControl.find("private") == std::string_view::npos;
+    int maxAge = storable ? parsed.maxAge() : -1;
+    if (maxAge <= 0) {
+        rememberBypass(key);
+    }
+    for (size_t offset = 0; offset < bodyLength; offset += SEGMENT_SIZE) {
+        auto piece = std::make_shared<const std::string>(response, headerEnd + offset,
+                                                         std::min<size_t>(SEGMENT_SIZE, bodyLength - offset));
+        segments[from + offset] = piece;
+        if (maxAge > 0) {
+            cacheManager->putSegment(key, first + offset / SEGMENT_SIZE, info.headers, *piece, total,
+                                     std::chrono::seconds(maxAge));
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief: Whether a segment with these headers and object length belongs to the version of
+ *         the object the earlier segments came from. The first segment loaded defines it. On
+ *         a mismatch every cached segment of the object is dropped.
+ */
+bool RangeCache::sameObject(const std::string& key, ObjectInfo& info, const std::string& headers, size_t length) {
+    std::string validator = validatorOf(headers);
+    if (info.length == 0) {
+        info.headers = headers;
+        info.length = length;
+        info.validator = validator;
+        return true;
+    }
+    if (validator == info.validator && length == info.length) {
+        return true;
+    }
+    logger->log(Logger::WARNING, key + " changed upstream, dropping its cached segments");
+    cacheManager->removeSegments(key, std::max(info.length, length));
+    return false;
+}
+
+// Whether key, an origin or a URL key, was recently found not worth segmenting
+bool RangeCache::bypassed(const std::string& key) {
+    std::lock_guard<std::mutex> lock(bypassMutex);
+    auto it = bypass.find(key);
+    if (it == bypass.end()) {
+        return false;
+    }
+    if (it->second <= std::chrono::steady_clock::now()) {
+        bypass.erase(it);
+        return false;
+    }
+    return true;
+}
+
+void RangeCache::rememberBypass(const std::string& key) {
+    std::lock_guard<std::mutex> lock(bypassMutex);
+    auto now = std::chrono::steady_clock::now();
+    if (bypass.size() >= MAX_BYPASS_ENTRIES) {
+        // Make room from what already ran out, never grow past the cap
+        for (auto it = bypass.begin(); it != bypass.end();) {
+            it = it->second <= now ? bypass.erase(it) : std::next(it);
+        }
+        if (bypass.size() >= MAX_BYPASS_ENTRIES) {
+            return;
+        }
+    }
+    bypass[key] = now + std::chrono::seconds(BYPASS_SECONDS);
+}
+
+// ETag of stripped segment headers, or Last-Modified when there is none
+std::string RangeCache::validatorOf(const std::string& headers) {
+    // findHeader skips the first line, which is the status line in a full header block
+    std::string block = "\r\n" + headers;
+    std::string validator = HttpParser::findHeader(block, "ETag");
+    return validator.empty() ? HttpParser::findHeader(block, "Last-Modified") : validator;
+}
+
+// Write the 206 head for start..end
+bool RangeCache::sendRangeHead(int clientSocket, const ObjectInfo& info, size_t start, size_t end,
+                               RequestTrace& trace) {
+    std::string headers = "HTTP/1.1 206 Partial Content\r\n" + info.headers;
+    headers += "Content-Range: bytes " + std::to_string(start) + "-" + std::to_string(end) + "/" +
+               std::to_string(info.length) + "\r\n";
+    headers += "Content-Length: " + std::to_string(end - start + 1) + "\r\n\r\n";
+    trace.status = 206;
+    if (!MessageForwarder::sendAll(clientSocket, headers.data(), headers.size())) {
+        return false;
+    }
+    trace.bytesOut += headers.size();
+    return true;
+}
+
+/**
+ * @brief: Write the part of start..end that lies in the loaded pieces. Returns false when
+ *         the client stopped reading.
+ */
+bool RangeCache::sendPieces(int clientSocket, const SegmentMap& segments, size_t start, size_t end,
+                            RequestTrace& trace) {
+    for (const auto& piece : segments) {
+        size_t offset = piece.first;
+        size_t size = piece.second->size();
+        if (offset + size <= start || offset > end) {
+            continue;
+        }
+        size_t from = std::max(start, offset) - offset;
+        size_t to = std::min(end + 1, offset + size) - offset;
+        if (!MessageForwarder::sendAll(clientSocket, piece.second->data() + from, to - from)) {
+            return false;
+        }
+        trace.bytesOut += to - from;
+    }
+    return true;
+}
+
+bool RangeCache::sendUnsatisfiable(int clientSocket, const ObjectInfo& info, RequestTrace& trace) {
+    std::string response = "HTTP/1.1 416 Range Not Satisfiable\r\n";
+    response += "Content-Range: bytes */" + std::to_string(info.length) + "\r\n";
+    response += "Content-Length: 0\r\n\r\n";
+    trace.status = 416;
+    if (!MessageForwarder::sendAll(clientSocket, response.data(), response.size())) {
+        return false;
+    }
+    trace.bytesOut += response.size();
+    return true;
+}
+
+// Status code of a cached whole response, its head starts with "HTTP/1.1 200 ..."
+int RangeCache::cachedStatus(const CacheEntry& entry) {
+    return entry.headers.size() > 9 ? atoi(entry.headers.c_str() + 9) : 0;
+}
+
+// Header lines of a response without its status line and the headers describing one particular body
+std::string RangeCache::stripEntityHeaders(const std::string& headerBlock) {
+    static const char* dropped[] = {
+        "Content-Length:", "Content-Range:", "Transfer-Encoding:", "Connection:", "Keep-Alive:", "Set-Cookie:"
+    };
+    std::string result;
+    size_t lineStart = headerBlock.find("\r\n");
+    while (lineStart != std::string::npos) {
+        lineStart += 2;
+        size_t lineEnd = headerBlock.find("\r\n", lineStart);
+        if (lineEnd == std::string::npos || lineEnd == lineStart) {
+            break;
+        }
+        bool keep = true;
+        for (const char* name : dropped) {
+            if (strncasecmp(headerBlock.c_str() + lineStart, name, strlen(name)) == 0) {
+                keep = false;
+                break;
+            }
+        }
+        if (keep) {
+            result += headerBlock.substr(lineStart, lineEnd - lineStart + 2);
+        }
+        lineStart = lineEnd;
+    }
+    return result;
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <string>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include "CacheManager.h"
+#include "HttpParser.h"
+#include "Logger.h"
+#include "ResponseFramer.h"
+
+class MessageForwarder;
+
+/**
+ * Serves single byte-range GETs from SEGMENT_SIZE pieces kept in the CacheManager,
+ * fetching only the missing pieces upstream and assembling the 206 response locally.
+ * When the origin answers a segment request with anything but a 206 before the client
+ * got any of the response, that answer is streamed to the client as it is. Origins that
+ * ignore ranges and objects that cannot be stored as segments are remembered for a
+ * while, and their requests go upstream unchanged. Every segment carries the origin's
+ * validator, and segments of different versions are never combined.
+ */
+class RangeCache {
+public:
+    enum ServeResult { RANGE_DECLINED, RANGE_SERVED, RANGE_CLOSE };
+
+private:
+    // What we know about the object the segments belong to
+    struct ObjectInfo {
+        std::string headers;     // origin header lines without status line, length or range
+        size_t length;
+        std::string validator;   // ETag, or Last-Modified without one
+    };
+    typedef std::map<size_t, std::shared_ptr<const std::string>> SegmentMap;
+
+    std::shared_ptr<CacheManager> cacheManager;
+    std::shared_ptr<Logger> logger;
+    std::shared_ptr<MessageForwarder> forwarder;
+    // Origins ("host:port") and URL keys not worth segmenting, until the time given
+    std::unordered_map<std::string, std::chrono::steady_clock::time_point> bypass;
+    std::mutex bypassMutex;
+
+    bool parseRange(const std::string& value, size_t& start, size_t& end, bool& openEnded);
+    bool loadSegments(HttpRequest& req, const std::string& key, size_t first, size_t last,
+                      SegmentMap& segments, ObjectInfo& info, int relaySocket = -1, ServeResult* relayed = nullptr);
+    bool fetchRun(HttpRequest& req, const std::string& key, size_t first, size_t last,
+                  SegmentMap& segments, ObjectInfo& info, int relaySocket, ServeResult* relayed);
+    bool bypassed(const std::string& key);
+    void rememberBypass(const std::string& key);
+    bool sendRangeHead(int clientSocket, const ObjectInfo& info, size_t start, size_t end, RequestTrace& trace);
+    bool sendPieces(int clientSocket, const SegmentMap& segments, size_t start, size_t end, RequestTrace& trace);
+    bool sendUnsatisfiable(int clientSocket, const ObjectInfo& info, RequestTrace& trace);
+    bool sameObject(const std::string& key, ObjectInfo& info, const std::string& headers, size_t length);
+    static std::string validatorOf(const std::string& headers);
+    static std::string stripEntityHeaders(const std::string& headerBlock);
+    static int cachedStatus(const CacheEntry& entry);
+
+public:
+    RangeCache(std::shared_ptr<CacheManager> cache, std::shared_ptr<Logger> logger,
+               std::shared_ptr<MessageForwarder> forwarder);
+    ServeResult serve(HttpRequest& req, int clientSocket, int clientId);
+};
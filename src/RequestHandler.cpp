@@ -5,75 +5,289 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <cstring>
+#include <strings.h>
+#include <cstdlib>
 #include <netdb.h>
 #include <unistd.h>
 #include <string>
+#include <algorithm>
 #include "MessageForwarder.h"
+#include "Gzip.h"
 
+// Responses larger than this are streamed through but never copied for the cache
+#define MAX_CACHEABLE_SIZE (8 * 1024 * 1024)
+// 404/410 answers without their own max-age are remembered this many seconds
+#define NEGATIVE_RESPONSE_TTL 30
 
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER; 
 
-RequestHandler::RequestHandler(std::shared_ptr<CacheManager> cache, std::shared_ptr<Logger> logger)
-    : cacheManager(cache), logger(logger), httpParser(std::make_unique<HttpParser>()) {}
+RequestHandler::RequestHandler(std::shared_ptr<CacheManager> cache, std::shared_ptr<Logger> logger,
+                               std::shared_ptr<MessageForwarder> forwarder)
+    : cacheManager(cache), logger(logger), forwarder(forwarder), httpParser(std::make_unique<HttpParser>()),
+      rangeCache(std::make_unique<RangeCache>(cache, logger, forwarder)) {}
 
-void RequestHandler::handleRequest(const std::string& request, int clientSocket, int clientId) {
+/**
+ * @brief: Answer one request. request holds its head and whatever the client sent after it;
+ *         bytes past the end of this request are handed back in remainder. Returns whether
+ *         the connection can carry another request.
+ */
+bool RequestHandler::handleRequest(const std::string& request, int clientSocket, int clientId, std::string& remainder) {
+    remainder.clear();
+    auto received = RequestTrace::Clock::now();
     try {
         // Parse the http request
         HttpRequest parsedRequest = httpParser->parseRequest(request);
+        parsedRequest.trace.start = received;
         if (!httpParser->isValidRequest(parsedRequest)) {
             //TODO: fix the format  it should be id: [TYPE] message rather than [TYPE] id:xxxxx
             logger->log(Logger::ERROR, std::to_string(clientId) + ":Invalid request received");
-            return ;
+            return false;
         }
-        // Build the cache keys
-        std::string cacheKey = parsedRequest.method + " " + parsedRequest.url;
-        std::string cachedResponse;
-        //TODO: test cache later Feb-22
-        /*
-        if (cacheManager->get(cacheKey, cachedResponse)) {
-            logger->log(Logger::INFO, "Cache hit for: " + parsedRequest.url);
-            return cachedResponse;
+        bool keepAlive = clientKeepsAlive(parsedRequest);
+        // Answers from the cache need a bodiless request, so that what follows the head is the next request
+        ResponseFramer body;
+        body.frameRequest(request.substr(0, request.size() - parsedRequest.body.size()));
+        bool bodiless = body.complete() && !body.error();
+        bool fromCache = bodiless && (parsedRequest.method == "GET" || parsedRequest.method == "HEAD");
+        if (fromCache) {
+            remainder = parsedRequest.body;
         }
-        */
-        forwardRequest(parsedRequest, clientSocket,clientId);
-        // TODO: test cache later 
-        // cacheManager->put(cacheKey, response, time(nullptr) + 300); // Cache for 5 minutes
-        
-        return;
+        parsedRequest.trace.parseMicros = RequestTrace::micros(received, RequestTrace::Clock::now());
+        parsedRequest.trace.bytesIn = request.size() - parsedRequest.body.size();
+        // Build the cache keys, HEAD is answered from the GET entry
+        std::string cacheKey = "GET " + parsedRequest.url;
+        // Byte ranges are assembled from cached segments where possible
+        if (fromCache && parsedRequest.method == "GET" && parsedRequest.headers.has(HeaderMap::RANGE)) {
+            RangeCache::ServeResult served = rangeCache->serve(parsedRequest, clientSocket, clientId);
+            if (served != RangeCache::RANGE_DECLINED) {
+                logAccess(parsedRequest, clientId);
+                return keepAlive && served == RangeCache::RANGE_SERVED;
+            }
+        }
+        if (fromCache) {
+            std::shared_ptr<CacheEntry> cached = cacheManager->get(cacheKey);
+            parsedRequest.trace.cache = cached ? CACHE_REVALIDATED : CACHE_MISS;
+            // A body the origin encoded is stored as sent, only clients that can decode it get it
+            std::string encoding = cached ? HttpParser::findHeader(cached->headers, "Content-Encoding") : "";
+            if (cached && !acceptsEncoding(parsedRequest, encoding)) {
+                logger->log("in cache, encoded as " + encoding + " which the client does not accept", clientId);
+                parsedRequest.trace.cache = CACHE_MISS;
+            } else if (cached && !cached->requiresValidation) {
+                logger->log("in cache, valid", clientId);
+                parsedRequest.trace.cache = CACHE_HIT;
+                CachedResult sent = sendCachedResponse(*cached, clientSocket, acceptsGzip(parsedRequest),
+                                                       parsedRequest.method == "HEAD", parsedRequest.trace);
+                if (sent != CACHED_UNUSABLE) {
+                    logAccess(parsedRequest, clientId);
+                    return sent == CACHED_SENT && keepAlive &&
+                           HttpParser::findHeader(cached->headers, "Connection").find("close") == std::string::npos;
+                }
+                logger->log(Logger::ERROR, "Failed to inflate cached body for " + parsedRequest.url);
+                parsedRequest.trace.cache = CACHE_MISS;
+            } else {
+                logger->log(cached ? "in cache, requires validation" : "not in cache", clientId);
+            }
+        }
+        bool reusable = forwardRequest(parsedRequest, clientSocket, clientId, remainder);
+        return keepAlive && reusable;
     } catch (const std::exception& e) {
         logger->log(Logger::ERROR, std::string("Error handling request: ") + e.what());
-        return;
+        return false;
     }
 }
 
-void RequestHandler::forwardRequest(HttpRequest httpRequest, int clientSocket, int clientId) {
+/**
+ * @brief: Forward a request upstream. remainder receives the bytes read past the request.
+ *         Returns whether the client got a complete, self-delimited response.
+ */
+bool RequestHandler::forwardRequest(HttpRequest httpRequest, int clientSocket, int clientId, std::string& remainder) {
     try {
-        MessageForwarder forwarder;
-        std::string serverName = httpRequest.headers["Host"];
-        std::string requestLine = httpRequest.method + " " + serverName + " " + httpRequest.version;
+        std::string serverName = httpRequest.headers.get(HeaderMap::HOST);
         
         // Log the request before forwarding
-        logger->log("Requesting \"" + httpRequest.request + "\" from " + serverName, clientId);
+        logger->event(EVENT_REQUEST, clientId, httpRequest.request, serverName);
         
-        std::string response;
-        if (httpRequest.method == "GET") {
-            forwarder.forwardGet(httpRequest, clientSocket, clientId, logger);
-        } else if (httpRequest.method == "POST") {
-            forwarder.forwardPost(httpRequest, clientSocket, clientId, logger);
-        } else if (httpRequest.method == "CONNECT") {
-            forwarder.forwardConnect(httpRequest, clientSocket, clientId, logger);
+        ResponseFramer parsed;
+        bool inSync = true;
+        if (httpRequest.method == "CONNECT") {
+            forwarder->forwardConnect(httpRequest, clientSocket, clientId, logger);
+            logAccess(httpRequest, clientId);
+            return false;
+        } else if (httpRequest.method == "GET") {
+            std::string captured;
+            inSync = forwarder->forwardRequest(httpRequest, clientSocket, clientId, logger, &captured, MAX_CACHEABLE_SIZE,
+                                               &parsed);
+            cacheResponse(httpRequest, captured, parsed, clientId);
         } else {
-            return;
+            inSync = forwarder->forwardRequest(httpRequest, clientSocket, clientId, logger, nullptr, 0, &parsed);
         }
+        remainder.swap(httpRequest.remainder);
+        logAccess(httpRequest, clientId);
         
-        // Parse the first line of the response to log
-        size_t firstLineEnd = response.find("\r\n");
-        std::string responseLine = response.substr(0, firstLineEnd);
-        // Log the response after receiving
-        logger->log("Received \"" + responseLine + "\" from " + serverName, clientId);
-        
-        return ;
+        return inSync && parsed.complete() && !parsed.error() && parsed.keepAlive();
     } catch (const std::exception& e) {
-        return ;
+        return false;
+    }
+}
+
+// HTTP/1.1 connections persist unless the client asks to close, earlier versions never do
+bool RequestHandler::clientKeepsAlive(const HttpRequest& request) {
+    if (request.version != "HTTP/1.1") {
+        return false;
+    }
+    for (HeaderMap::Id id : {HeaderMap::CONNECTION, HeaderMap::PROXY_CONNECTION}) {
+        std::string value = request.headers.get(id);
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        if (value.find("close") != std::string::npos) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Write the access log entry of an answered request
+void RequestHandler::logAccess(const HttpRequest& request, int clientId) {
+    logger->access(clientId, request.method, request.url, request.trace);
+}
+
+/**
+ * @brief: Write a cached response to the client, headers and the shared body separately.
+ *         Gzipped bodies go out as-is when the client accepts gzip and are inflated otherwise.
+ *         For HEAD only the headers are sent, the ones the GET would have carried. The
+ *         status and the bytes sent are noted in trace. CACHED_UNUSABLE means nothing was
+ *         sent, CACHED_CLIENT_GONE that a write failed part way.
+ */
+RequestHandler::CachedResult RequestHandler::sendCachedResponse(const CacheEntry& entry, int clientSocket,
+                                                                bool acceptsGzip, bool headOnly, RequestTrace& trace) {
+    const std::string* headers = entry.gzipped && acceptsGzip ? &entry.gzipHeaders : &entry.headers;
+    const std::string* body = headOnly ? nullptr : entry.body.get();
+    std::string inflated;
+    if (!headOnly && entry.gzipped && !acceptsGzip) {
+        if (!gzipDecompress(*entry.body, inflated)) {
+            return CACHED_UNUSABLE;
+        }
+        body = &inflated;
+    }
+    // The stored head starts with the status line, "HTTP/1.1 200 ..."
+    trace.status = entry.headers.size() > 9 ? atoi(entry.headers.c_str() + 9) : 0;
+    if (!MessageForwarder::sendAll(clientSocket, headers->data(), headers->size())) {
+        return CACHED_CLIENT_GONE;
+    }
+    trace.bytesOut += headers->size();
+    if (body != nullptr && !body->empty()) {
+        if (!MessageForwarder::sendAll(clientSocket, body->data(), body->size())) {
+            return CACHED_CLIENT_GONE;
+        }
+        trace.bytesOut += body->size();
+    }
+    return CACHED_SENT;
+}
+
+// Whether the client listed gzip in Accept-Encoding without refusing it via q=0
+bool RequestHandler::acceptsGzip(const HttpRequest& request) {
+    return acceptsEncoding(request, "gzip");
+}
+
+/**
+ * @brief: Whether a body in this content coding can go to the client: identity always
+ *         can, others must be listed in Accept-Encoding, by name or as "*", without q=0
+ */
+bool RequestHandler::acceptsEncoding(const HttpRequest& request, const std::string& coding) {
+    if (coding.empty() || strcasecmp(coding.c_str(), "identity") == 0) {
+        return true;
+    }
+    const std::string* acceptEncoding = request.headers.find(HeaderMap::ACCEPT_ENCODING);
+    if (!acceptEncoding) {
+        return false;
+    }
+    std::istringstream list(*acceptEncoding);
+    std::string item;
+    while (std::getline(list, item, ',')) {
+        size_t start = item.find_first_not_of(" \t");
+        if (start == std::string::npos) {
+            continue;
+        }
+        size_t end = item.find_first_of(" \t;", start);
+        std::string name = item.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        if (strcasecmp(name.c_str(), coding.c_str()) != 0 && name != "*") {
+            continue;
+        }
+        std::string params = end == std::string::npos ? "" : item.substr(end);
+        return params.find("q=0") == std::string::npos || params.find("q=0.") != std::string::npos;
+    }
+    return false;
+}
+
+/**
+ * @brief: Whether a response may be kept in a cache shared between users (RFC 9111
+ *         section 3): not private, no cookie being set, no authorized request unless the
+ *         origin allows it, and no Vary since the key holds the URL only
+ */
+bool RequestHandler::sharedCacheable(const HttpRequest& request, const ResponseFramer& parsed) {
+    std::string_view cacheControl = parsed.field(HeaderMap::CACHE_CONTROL);
+    if (cacheControl.find("private") != std::string_view::npos || parsed.hasField(HeaderMap::SET_COOKIE) ||
+        parsed.hasField(HeaderMap::VARY)) {
+        return false;
+    }
+    return !request.headers.has(HeaderMap::AUTHORIZATION) || cacheControl.find("public") != std::string_view::npos ||
+           cacheControl.find("s-maxage") != std::string_view::npos;
+}
+
+/**
+ * @brief: Store a forwarded response if its headers allow it. parsed is the parser that
+ *         read the response while it was forwarded. Entries are shared by every client
+ *         under the URL alone, so anything personal to the requesting user stays out.
+ */
+void RequestHandler::cacheResponse(const HttpRequest& request, const std::string& response,
+                                   const ResponseFramer& parsed, int clientId) {
+    if (response.empty() || !parsed.headersComplete()) {
+        return;
+    }
+    // Only successful responses and the negative answers that are cacheable by default
+    int status = parsed.statusCode();
+    std::string_view cacheControl = parsed.field(HeaderMap::CACHE_CONTROL);
+    if ((status != 200 && status != 404 && status != 410) || cacheControl.find("no-store") != std::string_view::npos) {
+        logger->log("not cacheable because of status or no-store", clientId);
+        return;
+    }
+    if (!sharedCacheable(request, parsed)) {
+        logger->log("not cacheable in a shared cache", clientId);
+        return;
+    }
+    int maxAge = parsed.maxAge();
+    if (maxAge < 0 && (status == 404 || status == 410)) {
+        maxAge = NEGATIVE_RESPONSE_TTL;
+    }
+    if (maxAge <= 0) {
+        return;
+    }
+    bool requiresValidation = cacheControl.find("no-cache") != std::string_view::npos;
+    cacheManager->put("GET " + request.url, response, std::chrono::seconds(maxAge), requiresValidation);
+    logger->event(EVENT_CACHED, clientId, std::to_string(maxAge));
+}
+
+/**
+ * @brief: Fetch an absolute http:// URL and cache the answer without a client, used to
+ *         warm the cache before the listener starts accepting
+ */
+bool RequestHandler::prefetch(const std::string& url) {
+    size_t hostStart = url.find("://");
+    if (hostStart == std::string::npos) {
+        return false;
+    }
+    hostStart += 3;
+    std::string authority = url.substr(hostStart, url.find('/', hostStart) - hostStart);
+    HttpRequest request = httpParser->parseRequest("GET " + url + " HTTP/1.1\r\nHost: " + authority + "\r\n\r\n");
+    if (!httpParser->isValidRequest(request)) {
+        return false;
+    }
+    std::string response;
+    ResponseFramer parsed;
+    if (!forwarder->fetchResponse(request, response, logger, &parsed)) {
+        return false;
     }
+    // Interim 1xx heads are not part of what gets cached
+    response.erase(0, parsed.interimLength());
+    cacheResponse(request, response, parsed, 0);
+    return true;
 }
\ No newline at end of file
@@ -4,15 +4,34 @@
 #include "HttpParser.h"
 #include "CacheManager.h"
 #include "Logger.h"
+#include "RangeCache.h"
+#include "ResponseFramer.h"
+
+class MessageForwarder;
 
 class RequestHandler {
 private:
+    enum CachedResult { CACHED_SENT, CACHED_UNUSABLE, CACHED_CLIENT_GONE };
+
     std::shared_ptr<CacheManager> cacheManager;
     std::shared_ptr<Logger> logger;
+    std::shared_ptr<MessageForwarder> forwarder;
     std::unique_ptr<HttpParser> httpParser;
+    std::unique_ptr<RangeCache> rangeCache;
+    CachedResult sendCachedResponse(const CacheEntry& entry, int clientSocket, bool acceptsGzip, bool headOnly,
+                                    RequestTrace& trace);
+    bool acceptsGzip(const HttpRequest& request);
+    static bool acceptsEncoding(const HttpRequest& request, const std::string& coding);
+    static bool clientKeepsAlive(const HttpRequest& request);
+    void logAccess(const HttpRequest& request, int clientId);
+    static bool sharedCacheable(const HttpRequest& request, const ResponseFramer& parsed);
+    void cacheResponse(const HttpRequest& request, const std::string& response, const ResponseFramer& parsed,
+                       int clientId);
 
 public:
-    RequestHandler(std::shared_ptr<CacheManager> cache, std::shared_ptr<Logger> logger);
-    void handleRequest(const std::string& request, int clientSocket, int clientId);
-    void forwardRequest(HttpRequest httpRequest, int clientSocket, int clientId);
+    RequestHandler(std::shared_ptr<CacheManager> cache, std::shared_ptr<Logger> logger,
+                   std::shared_ptr<MessageForwarder> forwarder);
+    bool handleRequest(const std::string& request, int clientSocket, int clientId, std::string& remainder);
+    bool forwardRequest(HttpRequest httpRequest, int clientSocket, int clientId, std::string& remainder);
+    bool prefetch(const std::string& url);
 }; 
\ No newline at end of file
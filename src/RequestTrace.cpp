@@ -0,0 +1,42 @@
+#include "RequestTrace.h"
+#include <ctime>
+
+RequestTrace::RequestTrace()
+    : start(Clock::now()), status(0), bytesIn(0), bytesOut(0), cache(CACHE_BYPASS), upstreamReused(false),
+      parseMicros(0), dnsMicros(0), connectMicros(0), ttfbMicros(0), transferMicros(0) {}
+
+uint32_t RequestTrace::micros(Clock::time_point from, Clock::time_point to) {
+    if (to <= from) {
+        return 0;
+    }
+    return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(to - from).count());
+}
+
+/**
+ * @brief: Wall clock time of a steady clock reading, in microseconds since the epoch. Each
+ *         thread keeps the offset between the two clocks and takes a coarse wall clock
+ *         reading only when it is over a second old, so stamping a record costs no clock call.
+ */
+int64_t RequestTrace::wallMicros(Clock::time_point at) {
+    thread_local Clock::time_point calibratedAt;
+    thread_local int64_t offset = 0;
+    thread_local bool calibrated = false;
+    if (!calibrated || at - calibratedAt > std::chrono::seconds(1)) {
+        struct timespec wall;
+        clock_gettime(CLOCK_REALTIME_COARSE, &wall);
+        calibratedAt = Clock::now();
+        offset = static_cast<int64_t>(wall.tv_sec) * 1000000 + wall.tv_nsec / 1000 -
+                 std::chrono::duration_cast<std::chrono::microseconds>(calibratedAt.time_since_epoch()).count();
+        calibrated = true;
+    }
+    return std::chrono::duration_cast<std::chrono::microseconds>(at.time_since_epoch()).count() + offset;
+}
+
+const char* RequestTrace::cacheStatusName(CacheStatus status) {
+    switch (status) {
+        case CACHE_MISS: return "MISS";
+        case CACHE_HIT: return "HIT";
+        case CACHE_REVALIDATED: return "REVALIDATED";
+        default: return "BYPASS";
+    }
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+// How the cache took part in answering a request. There is no stale status: expired
+// entries are never served, not even when the origin is down.
+enum CacheStatus : uint8_t {
+    CACHE_BYPASS,        // not a cacheable request, e.g. a POST or CONNECT
+    CACHE_MISS,          // nothing usable cached, forwarded
+    CACHE_HIT,           // answered from the cache
+    CACHE_REVALIDATED    // cached but marked no-cache, fetched again from the origin
+};
+
+/**
+ * What happened to one request, collected on its way through the proxy for the access
+ * log entry. Phase durations are in microseconds and stay zero for phases that did not
+ * happen, such as DNS and connect on a reused upstream connection.
+ */
+struct RequestTrace {
+    typedef std::chrono::steady_clock Clock;
+
+    Clock::time_point start;   // request head complete
+    int status;                // status sent to the client, 0 if there was none
+    uint64_t bytesIn;          // request bytes read from the client, head and body
+    uint64_t bytesOut;         // response bytes written to the client
+    CacheStatus cache;
+    bool upstreamReused;
+    uint32_t parseMicros;
+    uint32_t dnsMicros;
+    uint32_t connectMicros;
+    uint32_t ttfbMicros;       // request sent until the first response byte
+    uint32_t transferMicros;   // first response byte until the last
+
+    RequestTrace();
+    static uint32_t micros(Clock::time_point from, Clock::time_point to);
+    static int64_t wallMicros(Clock::time_point at);
+    static const char* cacheStatusName(CacheStatus status);
+};
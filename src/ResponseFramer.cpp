@@ -0,0 +1,383 @@
+#include "ResponseFramer.h"
+#include <cstring>
+#include <strings.h>
+#include <cstdlib>
+
+// Longest header section we are willing to buffer
+#define MAX_RESPONSE_HEADERS (64 * 1024)
+
+namespace {
+
+std::string_view trim(std::string_view value) {
+    size_t start = value.find_first_not_of(" \t");
+    if (start == std::string_view::npos) {
+        return std::string_view();
+    }
+    size_t end = value.find_last_not_of(" \t");
+    return value.substr(start, end - start + 1);
+}
+
+bool equalsIgnoreCase(std::string_view value, const char* token) {
+    size_t length = strlen(token);
+    return value.size() == length && strncasecmp(value.data(), token, length) == 0;
+}
+
+// Whether a comma separated header value contains token, case-insensitively
+bool hasToken(std::string_view value, const char* token) {
+    size_t start = 0;
+    while (start <= value.size()) {
+        size_t comma = value.find(',', start);
+        if (comma == std::string_view::npos) {
+            comma = value.size();
+        }
+        if (equalsIgnoreCase(trim(value.substr(start, comma - start)), token)) {
+            return true;
+        }
+        start = comma + 1;
+    }
+    return false;
+}
+
+int hexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+} // namespace
+
+ResponseFramer::ResponseFramer(bool headRequest)
+    : headRequest(headRequest), headersDone(false), done(false), failed(false), status(0),
+      bodyMode(NO_BODY), persistent(false), remaining(0), chunkState(CHUNK_SIZE), sizeDigits(false), fields(),
+      present(0), lengthConflict(false), interimBytes(0) {}
+
+/**
+ * @brief: Frame the body of a request instead of a response, requestHead being its request
+ *         line and headers. Chunked has to be the final coding, and without Transfer-Encoding
+ *         or Content-Length a request has no body (RFC 7230 section 3.3.3).
+ */
+void ResponseFramer::frameRequest(const std::string& requestHead) {
+    headerBlock = requestHead;
+    headersDone = true;
+    indexFields();
+    std::string_view transferEncoding = trim(field(HeaderMap::TRANSFER_ENCODING));
+    if (!transferEncoding.empty()) {
+        size_t lastComma = transferEncoding.rfind(',');
+        bodyMode = CHUNKED;
+        failed = !equalsIgnoreCase(trim(lastComma == std::string_view::npos ? transferEncoding
+                                                                            : transferEncoding.substr(lastComma + 1)),
+                                   "chunked");
+        return;
+    }
+    std::string_view contentLength = field(HeaderMap::CONTENT_LENGTH);
+    if (contentLength.empty()) {
+        bodyMode = NO_BODY;
+        done = true;
+        return;
+    }
+    startLengthBody(contentLength);
+}
+
+/**
+ * @brief: Consume the next bytes read from the origin. Returns how many of them belong to
+ *         this response, anything after that is not part of it. Stops at errors.
+ */
+size_t ResponseFramer::feed(const char* data, size_t length) {
+    size_t used = 0;
+    while (used < length && !done && !failed) {
+        if (!headersDone) {
+            used += feedHeaders(data + used, length - used);
+        } else if (bodyMode == CONTENT_LENGTH) {
+            size_t take = remaining < length - used ? static_cast<size_t>(remaining) : length - used;
+            remaining -= take;
+            used += take;
+            done = remaining == 0;
+        } else if (bodyMode == CHUNKED) {
+            used += feedChunked(data + used, length - used);
+        } else {
+            used = length;  // until close, everything is body
+        }
+    }
+    return used;
+}
+
+/**
+ * @brief: The origin closed the connection. That ends a read-until-close body, any other
+ *         unfinished response was truncated.
+ */
+void ResponseFramer::finish() {
+    if (done) {
+        return;
+    }
+    if (headersDone && bodyMode == UNTIL_CLOSE) {
+        done = true;
+    } else {
+        failed = true;
+    }
+}
+
+size_t ResponseFramer::feedHeaders(const char* data, size_t length) {
+    size_t before = headerBlock.size();
+    // Resume the terminator search a few bytes back in case it straddles two reads
+    size_t searchFrom = before < 3 ? 0 : before - 3;
+    headerBlock.append(data, length);
+    size_t end = headerBlock.find("\r\n\r\n", searchFrom);
+    if (end == std::string::npos) {
+        if (headerBlock.size() > MAX_RESPONSE_HEADERS) {
+            failed = true;
+        }
+        return length;
+    }
+    size_t used = end + 4 - before;
+    headerBlock.resize(end + 4);
+
+    if (headerBlock.compare(0, 5, "HTTP/") != 0 || headerBlock.size() < 12) {
+        failed = true;
+        return used;
+    }
+    status = atoi(headerBlock.c_str() + 9);
+    if (status < 100 || status > 999) {
+        failed = true;
+        return used;
+    }
+    if (status < 200 && status != 101) {
+        // Interim response, the final one follows on the same connection
+        interimBytes += headerBlock.size();
+        headerBlock.clear();
+        return used;
+    }
+    headersDone = true;
+    indexFields();
+    startBody();
+    return used;
+}
+
+/**
+ * @brief: Record where each well-known field's value sits in headerBlock. The first
+ *         occurrence of a field wins, a later Content-Length that differs is noted as a
+ *         conflict. Done once, when the header section is complete.
+ */
+void ResponseFramer::indexFields() {
+    present = 0;
+    lengthConflict = false;
+    size_t lineStart = headerBlock.find("\r\n");
+    while (lineStart != std::string::npos) {
+        lineStart += 2;
+        size_t lineEnd = headerBlock.find("\r\n", lineStart);
+        if (lineEnd == std::string::npos || lineEnd == lineStart) {
+            break;
+        }
+        size_t colon = headerBlock.find(':', lineStart);
+        if (colon < lineEnd) {
+            HeaderMap::Id id = HeaderMap::lookup(headerBlock.data() + lineStart, colon - lineStart);
+            std::string_view value = trim(std::string_view(headerBlock).substr(colon + 1, lineEnd - colon - 1));
+            if (id == HeaderMap::CONTENT_LENGTH && hasField(id) && value != field(id)) {
+                lengthConflict = true;
+            }
+            if (id != HeaderMap::UNKNOWN && !hasField(id)) {
+                fields[id].offset = static_cast<uint32_t>(value.data() - headerBlock.data());
+                fields[id].length = static_cast<uint32_t>(value.size());
+                present |= uint64_t(1) << id;
+            }
+        }
+        lineStart = lineEnd;
+    }
+}
+
+// Value of a well-known field of the final response, empty when it is absent
+std::string_view ResponseFramer::field(HeaderMap::Id id) const {
+    if (!hasField(id)) {
+        return std::string_view();
+    }
+    return std::string_view(headerBlock).substr(fields[id].offset, fields[id].length);
+}
+
+std::string_view ResponseFramer::statusLine() const {
+    std::string_view block(headerBlock);
+    return block.substr(0, block.find("\r\n"));
+}
+
+// Cache-Control max-age in seconds, -1 when absent or unreadable
+int ResponseFramer::maxAge() const {
+    std::string_view cacheControl = field(HeaderMap::CACHE_CONTROL);
+    size_t position = cacheControl.find("max-age=");
+    if (position == std::string_view::npos) {
+        return -1;
+    }
+    int value = -1;
+    for (size_t i = position + 8; i < cacheControl.size() && cacheControl[i] >= '0' && cacheControl[i] <= '9'; ++i) {
+        value = (value < 0 ? 0 : value) * 10 + (cacheControl[i] - '0');
+        if (value > 1000000000) {
+            return -1;
+        }
+    }
+    return value;
+}
+
+// Work out how the body is delimited once the final headers are in
+void ResponseFramer::startBody() {
+    std::string_view connection = field(HeaderMap::CONNECTION);
+    if (headerBlock.compare(0, 8, "HTTP/1.1") == 0) {
+        persistent = !hasToken(connection, "close");
+    } else {
+        persistent = hasToken(connection, "keep-alive");
+    }
+
+    if (headRequest || status == 204 || status == 304 || status < 200) {
+        bodyMode = NO_BODY;
+        // A switched protocol (101) is no longer HTTP, the connection cannot be reused
+        persistent = persistent && status != 101;
+        done = true;
+        return;
+    }
+
+    std::string_view transferEncoding = trim(field(HeaderMap::TRANSFER_ENCODING));
+    if (!transferEncoding.empty()) {
+        // Chunked has to be the final coding, otherwise the body runs until close
+        size_t lastComma = transferEncoding.rfind(',');
+        std::string_view last = trim(lastComma == std::string_view::npos ? transferEncoding
+                                                                         : transferEncoding.substr(lastComma + 1));
+        bodyMode = equalsIgnoreCase(last, "chunked") ? CHUNKED : UNTIL_CLOSE;
+        return;
+    }
+
+    std::string_view contentLength = field(HeaderMap::CONTENT_LENGTH);
+    if (contentLength.empty()) {
+        bodyMode = UNTIL_CLOSE;
+        return;
+    }
+    startLengthBody(contentLength);
+}
+
+// Content-Length delimited body. Repeated identical values ("10, 10", or on several lines) are allowed,
+// anything else is an error
+void ResponseFramer::startLengthBody(std::string_view contentLength) {
+    if (lengthConflict) {
+        failed = true;
+        return;
+    }
+    bool haveValue = false;
+    size_t start = 0;
+    while (start <= contentLength.size()) {
+        size_t comma = contentLength.find(',', start);
+        if (comma == std::string_view::npos) {
+            comma = contentLength.size();
+        }
+        std::string_view item = trim(contentLength.substr(start, comma - start));
+        if (item.empty() || item.size() > 19 || item.find_first_not_of("0123456789") != std::string_view::npos) {
+            failed = true;
+            return;
+        }
+        uint64_t value = 0;
+        for (char digit : item) {
+            value = value * 10 + static_cast<uint64_t>(digit - '0');
+        }
+        if (haveValue && value != remaining) {
+            failed = true;
+            return;
+        }
+        remaining = value;
+        haveValue = true;
+        start = comma + 1;
+    }
+    bodyMode = CONTENT_LENGTH;
+    done = remaining == 0;
+}
+
+size_t ResponseFramer::feedChunked(const char* data, size_t length) {
+    size_t used = 0;
+    while (used < length && !done && !failed) {
+        char c = data[used];
+        switch (chunkState) {
+            case CHUNK_SIZE: {
+                int digit = hexValue(c);
+                if (digit >= 0) {
+                    if (remaining > (UINT64_MAX >> 4)) {
+                        failed = true;
+                        break;
+                    }
+                    remaining = (remaining << 4) | static_cast<uint64_t>(digit);
+                    sizeDigits = true;
+                } else if (!sizeDigits) {
+                    failed = true;
+                } else if (c == ';' || c == ' ' || c == '\t') {
+                    chunkState = CHUNK_EXTENSION;
+                } else if (c == '\r') {
+                    chunkState = CHUNK_SIZE_LF;
+                } else {
+                    failed = true;
+                }
+                ++used;
+                break;
+            }
+            case CHUNK_EXTENSION:
+                // Extensions are passed through uninterpreted
+                if (c == '\r') {
+                    chunkState = CHUNK_SIZE_LF;
+                }
+                ++used;
+                break;
+            case CHUNK_SIZE_LF:
+                if (c != '\n') {
+                    failed = true;
+                    break;
+                }
+                ++used;
+                chunkState = remaining == 0 ? TRAILER_LINE_START : CHUNK_DATA;
+                break;
+            case CHUNK_DATA: {
+                size_t take = remaining < length - used ? static_cast<size_t>(remaining) : length - used;
+                remaining -= take;
+                used += take;
+                if (remaining == 0) {
+                    chunkState = CHUNK_DATA_CR;
+                }
+                break;
+            }
+            case CHUNK_DATA_CR:
+                if (c != '\r') {
+                    failed = true;
+                    break;
+                }
+                ++used;
+                chunkState = CHUNK_DATA_LF;
+                break;
+            case CHUNK_DATA_LF:
+                if (c != '\n') {
+                    failed = true;
+                    break;
+                }
+                ++used;
+                chunkState = CHUNK_SIZE;
+                sizeDigits = false;
+                break;
+            case TRAILER_LINE_START:
+                // An empty line ends the trailer section and the message
+                chunkState = c == '\r' ? TRAILER_END_LF : TRAILER_LINE;
+                ++used;
+                break;
+            case TRAILER_LINE:
+                if (c == '\n') {
+                    chunkState = TRAILER_LINE_START;
+                }
+                ++used;
+                break;
+            case TRAILER_END_LF:
+                if (c != '\n') {
+                    failed = true;
+                    break;
+                }
+                ++used;
+                done = true;
+                break;
+        }
+    }
+    return used;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include <cstdint>
+#include "HeaderMap.h"
+
+/**
+ * Incremental HTTP/1.1 response framing. Bytes are fed as they arrive from the origin
+ * and the framer tells how many of them belong to the current response and when it is
+ * complete, following RFC 7230 section 3.3.3: bodiless responses (HEAD, 1xx, 204, 304),
+ * chunked with extensions and trailers, Content-Length, or read until close.
+ * Interim 1xx responses are passed over and the final response is framed after them.
+ * The final header section is indexed in the same pass: well-known fields are kept as
+ * spans of the header block, so forwarding, caching and logging read them without
+ * parsing the response again. A framer can also delimit a request body, see frameRequest.
+ */
+class ResponseFramer {
+public:
+    enum Mode {
+        NO_BODY,
+        CONTENT_LENGTH,
+        CHUNKED,
+        UNTIL_CLOSE
+    };
+
+private:
+    enum ChunkState {
+        CHUNK_SIZE,
+        CHUNK_EXTENSION,
+        CHUNK_SIZE_LF,
+        CHUNK_DATA,
+        CHUNK_DATA_CR,
+        CHUNK_DATA_LF,
+        TRAILER_LINE_START,
+        TRAILER_LINE,
+        TRAILER_END_LF
+    };
+
+    // Value of a field as a position in headerBlock
+    struct Span {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    bool headRequest;
+    std::string headerBlock;   // final response status line and headers, blank line included
+    bool headersDone;
+    bool done;
+    bool failed;
+    int status;
+    Mode bodyMode;
+    bool persistent;
+    uint64_t remaining;        // body bytes left (Content-Length) or in the current chunk
+    ChunkState chunkState;
+    bool sizeDigits;
+    Span fields[HeaderMap::KNOWN_COUNT];
+    uint64_t present;          // bit per HeaderMap::Id found in headerBlock
+    bool lengthConflict;       // Content-Length lines with different values
+    size_t interimBytes;       // interim 1xx responses passed over before the final head
+
+    void indexFields();
+    size_t feedHeaders(const char* data, size_t length);
+    void startBody();
+    void startLengthBody(std::string_view contentLength);
+    size_t feedChunked(const char* data, size_t length);
+
+public:
+    explicit ResponseFramer(bool headRequest = false);
+
+    void frameRequest(const std::string& requestHead);
+    size_t feed(const char* data, size_t length);
+    void finish();
+
+    bool headersComplete() const { return headersDone; }
+    bool complete() const { return done; }
+    bool error() const { return failed; }
+    const std::string& headers() const { return headerBlock; }
+    // Bytes fed before the body starts, interim responses included
+    size_t headLength() const { return interimBytes + headerBlock.size(); }
+    // Bytes of interim 1xx responses fed before the final head
+    size_t interimLength() const { return interimBytes; }
+    std::string_view statusLine() const;
+    std::string_view field(HeaderMap::Id id) const;
+    bool hasField(HeaderMap::Id id) const { return (present >> id) & 1; }
+    int maxAge() const;
+    int statusCode() const { return status; }
+    Mode mode() const { return bodyMode; }
+    // Body bytes still expected, the declared length before any is fed for Content-Length bodies
+    uint64_t bytesRemaining() const { return remaining; }
+    bool keepAlive() const { return persistent && bodyMode != UNTIL_CLOSE; }
+};
@@ -0,0 +1,104 @@
+#include "TimerService.h"
+#include <sys/socket.h>
+
+TimerService::TimerService(const PhaseTimeouts& timeouts)
+    : timeouts(timeouts), nextId(1), stopping(false), stats() {
+    worker = std::thread(&TimerService::run, this);
+}
+
+TimerService::~TimerService() {
+    {
+        std::lock_guard<std::mutex> lock(timerMutex);
+        stopping = true;
+    }
+    wakeup.notify_one();
+    worker.join();
+}
+
+/**
+ * @brief: Shut fd down once timeout has passed, unless the timer is cancelled first
+ */
+TimerService::TimerId TimerService::arm(int fd, std::chrono::milliseconds timeout) {
+    std::lock_guard<std::mutex> lock(timerMutex);
+    TimerId id = nextId++;
+    Timer timer;
+    timer.fd = fd;
+    timer.deadline = Clock::now() + timeout;
+    timer.fired = false;
+    timers[id] = timer;
+    bool earliest = heap.empty() || timer.deadline < heap.top().first;
+    heap.push(HeapEntry(timer.deadline, id));
+    ++stats.armed;
+    if (earliest) {
+        wakeup.notify_one();
+    }
+    return id;
+}
+
+/**
+ * @brief: Move the deadline to timeout from now. Pushing it later, the common case for
+ *         idle timers, only updates the timer; the heap catches up when the old entry pops.
+ */
+void TimerService::rearm(TimerId id, std::chrono::milliseconds timeout) {
+    std::lock_guard<std::mutex> lock(timerMutex);
+    auto it = timers.find(id);
+    if (it == timers.end() || it->second.fired) {
+        return;
+    }
+    Clock::time_point deadline = Clock::now() + timeout;
+    bool earlier = deadline < it->second.deadline;
+    it->second.deadline = deadline;
+    if (earlier) {
+        heap.push(HeapEntry(deadline, id));
+        wakeup.notify_one();
+    }
+}
+
+/**
+ * @brief: Forget the timer. Returns true if it already fired and shut the socket down.
+ *         Once this returns the timer can no longer touch the socket.
+ */
+bool TimerService::cancel(TimerId id) {
+    std::lock_guard<std::mutex> lock(timerMutex);
+    auto it = timers.find(id);
+    if (it == timers.end()) {
+        return false;
+    }
+    bool fired = it->second.fired;
+    timers.erase(it);
+    return fired;
+}
+
+TimerService::Stats TimerService::getStats() {
+    std::lock_guard<std::mutex> lock(timerMutex);
+    Stats copy = stats;
+    copy.active = timers.size();
+    return copy;
+}
+
+void TimerService::run() {
+    std::unique_lock<std::mutex> lock(timerMutex);
+    while (!stopping) {
+        if (heap.empty()) {
+            wakeup.wait(lock);
+            continue;
+        }
+        HeapEntry next = heap.top();
+        if (next.first > Clock::now()) {
+            wakeup.wait_until(lock, next.first);
+            continue;
+        }
+        heap.pop();
+        auto it = timers.find(next.second);
+        if (it == timers.end() || it->second.fired || it->second.deadline < next.first) {
+            continue;  // cancelled, or superseded by an earlier entry
+        }
+        if (it->second.deadline > next.first) {
+            heap.push(HeapEntry(it->second.deadline, next.second));  // pushed out meanwhile
+            continue;
+        }
+        it->second.fired = true;
+        ++stats.fired;
+        shutdown(it->second.fd, SHUT_RDWR);
+    }
+}
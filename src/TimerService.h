@@ -0,0 +1,73 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+
+// How long each phase of a proxied exchange may take
+struct PhaseTimeouts {
+    std::chrono::milliseconds clientHeader;  // client request head
+    std::chrono::milliseconds connect;       // upstream connect, all addresses together
+    std::chrono::milliseconds firstByte;     // request sent until the first response byte
+    std::chrono::milliseconds idleBody;      // silence between two response reads
+    std::chrono::milliseconds tunnelIdle;    // CONNECT tunnel without traffic either way
+    std::chrono::milliseconds originQueue;   // waiting for a free slot at a busy origin
+    std::chrono::milliseconds expectContinue; // origin deciding on an Expect: 100-continue body
+
+    PhaseTimeouts()
+        : clientHeader(10000), connect(5000), firstByte(30000), idleBody(30000), tunnelIdle(300000), originQueue(10000),
+          expectContinue(1000) {}
+};
+
+/**
+ * One thread enforcing every socket deadline in the process. A timer watches a socket,
+ * and when it expires the socket is shut down, which wakes whoever is blocked on it with
+ * EOF. Owners push idle deadlines out as traffic flows and cancel the timer before closing
+ * the socket; cancel tells whether the deadline had passed.
+ */
+class TimerService {
+public:
+    typedef uint64_t TimerId;
+
+    struct Stats {
+        uint64_t armed;
+        uint64_t fired;
+        size_t active;
+    };
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    struct Timer {
+        int fd;
+        Clock::time_point deadline;
+        bool fired;
+    };
+    // Heap entries go stale when a timer is pushed out, they are re-queued lazily
+    typedef std::pair<Clock::time_point, TimerId> HeapEntry;
+
+    PhaseTimeouts timeouts;
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> heap;
+    std::unordered_map<TimerId, Timer> timers;
+    std::mutex timerMutex;
+    std::condition_variable wakeup;
+    std::thread worker;
+    TimerId nextId;
+    bool stopping;
+    Stats stats;
+
+    void run();
+
+public:
+    explicit TimerService(const PhaseTimeouts& timeouts = PhaseTimeouts());
+    ~TimerService();
+
+    const PhaseTimeouts& phases() const { return timeouts; }
+    TimerId arm(int fd, std::chrono::milliseconds timeout);
+    void rearm(TimerId id, std::chrono::milliseconds timeout);
+    bool cancel(TimerId id);
+    Stats getStats();
+};
@@ -0,0 +1,11 @@
+#pragma once
+#include <cstdint>
+
+// How request bodies announced with Expect: 100-continue are handled
+struct UploadPolicy {
+    bool answerLocally;     // send 100 Continue ourselves instead of relaying the origin's answer
+    uint64_t maxBodySize;   // larger declared bodies are refused with 413 before being read, 0 for no limit
+
+    UploadPolicy()
+        : answerLocally(false), maxBodySize(0) {}
+};
@@ -1,14 +1,263 @@
 #include "ProxyServer.h"
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <thread>
+#include <csignal>
+#include <unistd.h>
+#include <pthread.h>
 
-int main() {
+/**
+ * @brief: Parse "phase=seconds,..." with phases header, connect, ttfb, idle, tunnel, queue and continue
+ */
+static bool parseTimeouts(const std::string& spec, PhaseTimeouts& timeouts) {
+    std::stringstream items(spec);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        size_t equals = item.find('=');
+        if (equals == std::string::npos) {
+            return false;
+        }
+        std::string phase = item.substr(0, equals);
+        std::chrono::milliseconds value;
+        try {
+            value = std::chrono::milliseconds(static_cast<long long>(std::stod(item.substr(equals + 1)) * 1000));
+        } catch (const std::exception& e) {
+            return false;
+        }
+        if (value.count() <= 0) {
+            return false;
+        }
+        if (phase == "header") {
+            timeouts.clientHeader = value;
+        } else if (phase == "connect") {
+            timeouts.connect = value;
+        } else if (phase == "ttfb") {
+            timeouts.firstByte = value;
+        } else if (phase == "idle") {
+            timeouts.idleBody = value;
+        } else if (phase == "tunnel") {
+            timeouts.tunnelIdle = value;
+        } else if (phase == "queue") {
+            timeouts.originQueue = value;
+        } else if (phase == "continue") {
+            timeouts.expectContinue = value;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief: Parse the hedging option: "150", "p95" or either with ":budget" appended
+ */
+static bool parseHedging(const std::string& spec, HedgeConfig& hedging) {
+    std::string threshold = spec;
+    size_t colon = spec.find(':');
+    try {
+        if (colon != std::string::npos) {
+            threshold = spec.substr(0, colon);
+            hedging.budget = std::stod(spec.substr(colon + 1));
+        }
+        if (!threshold.empty() && threshold[0] == 'p') {
+            hedging.percentile = std::stod(threshold.substr(1)) / 100;
+            hedging.delay = std::chrono::milliseconds(0);
+        } else {
+            hedging.delay = std::chrono::milliseconds(std::stol(threshold));
+        }
+    } catch (const std::exception& e) {
+        return false;
+    }
+    if (hedging.budget <= 0 || hedging.percentile <= 0 || hedging.percentile >= 1 || hedging.delay.count() < 0 ||
+        (threshold[0] != 'p' && hedging.delay.count() == 0)) {
+        return false;
+    }
+    hedging.enabled = true;
+    return true;
+}
+
+/**
+ * @brief: Parse the origin limits option: "perOrigin" or "perOrigin:total"
+ */
+static bool parseLimits(const std::string& spec, size_t& maxPerOrigin, size_t& maxTotal) {
+    size_t colon = spec.find(':');
+    try {
+        maxPerOrigin = std::stoul(spec.substr(0, colon));
+        if (colon != std::string::npos) {
+            maxTotal = std::stoul(spec.substr(colon + 1));
+        }
+    } catch (const std::exception& e) {
+        return false;
+    }
+    return maxPerOrigin > 0 && maxTotal > 0;
+}
+
+/**
+ * @brief: Parse the upload policy option: "relay" or "local", optionally ":maxBodyBytes"
+ */
+static bool parseUploads(const std::string& spec, UploadPolicy& uploads) {
+    size_t colon = spec.find(':');
+    std::string mode = spec.substr(0, colon);
+    if (mode != "relay" && mode != "local") {
+        return false;
+    }
+    uploads.answerLocally = mode == "local";
+    if (colon != std::string::npos) {
+        try {
+            uploads.maxBodySize = std::stoull(spec.substr(colon + 1));
+        } catch (const std::exception& e) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief: Parse a whole decimal number within [min, max]
+ */
+static bool parseNumber(const std::string& spec, unsigned long min, unsigned long max, unsigned long& value) {
+    size_t used = 0;
     try {
-        // Create the server and listen at 8080
-        ProxyServer server(12345);
+        value = std::stoul(spec, &used);
+    } catch (const std::exception& e) {
+        return false;
+    }
+    return used == spec.size() && spec[0] != '-' && value >= min && value <= max;
+}
+
+/**
+ * Usage: proxy_server [-p port] [-s snapshot] [-w warmlist] [-c concurrency] [-T timeouts] [-H hedging] [-L limits] [-E uploads] [-B]
+ *   -s  restore the cache from this file at startup and write it back on SIGUSR1,
+ *       SIGINT or SIGTERM (SIGUSR1 also logs cache and pool statistics)
+ *   -w  file with one URL per line to prefetch before accepting clients
+ *   -c  number of concurrent prefetches (default 8)
+ *   -T  per-phase deadlines in seconds, e.g. header=10,connect=5,ttfb=30,idle=30,tunnel=300,queue=10,continue=1
+ *   -H  hedge slow GETs after this many milliseconds, or pNN to use the origin's NNth
+ *       latency percentile; optional ":budget" caps hedges per request (default 0.05)
+ *   -L  upstream requests in flight per origin, optionally ":total" across all origins
+ *       (default 16:256); requests over the limit queue for up to the queue deadline
+ *   -E  Expect: 100-continue handling, "relay" the origin's answer (default) or answer
+ *       "local"ly; optional ":bytes" refuses larger declared bodies with 413 unread
+ *   -B  write the binary log logs/proxy.bin instead of logs/proxy.log, read it with logdump
+ */
+int main(int argc, char* argv[]) {
+    int port = 12345;
+    std::string snapshotPath;
+    std::string warmListPath;
+    size_t warmConcurrency = 8;
+    PhaseTimeouts timeouts;
+    HedgeConfig hedging;
+    size_t maxPerOrigin = 16;
+    size_t maxTotal = 256;
+    UploadPolicy uploads;
+    bool binaryLog = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:s:w:c:T:H:L:E:B")) != -1) {
+        switch (opt) {
+            case 'p': {
+                unsigned long value;
+                if (!parseNumber(optarg, 1, 65535, value)) {
+                    std::cerr << "Invalid port: " << optarg << std::endl;
+                    return 1;
+                }
+                port = static_cast<int>(value);
+                break;
+            }
+            case 's': snapshotPath = optarg; break;
+            case 'w': warmListPath = optarg; break;
+            case 'c': {
+                unsigned long value;
+                if (!parseNumber(optarg, 1, 1024, value)) {
+                    std::cerr << "Invalid concurrency: " << optarg << std::endl;
+                    return 1;
+                }
+                warmConcurrency = value;
+                break;
+            }
+            case 'T':
+                if (!parseTimeouts(optarg, timeouts)) {
+                    std::cerr << "Invalid timeouts: " << optarg << std::endl;
+                    return 1;
+                }
+                break;
+            case 'H':
+                if (!parseHedging(optarg, hedging)) {
+                    std::cerr << "Invalid hedging: " << optarg << std::endl;
+                    return 1;
+                }
+                break;
+            case 'L':
+                if (!parseLimits(optarg, maxPerOrigin, maxTotal)) {
+                    std::cerr << "Invalid limits: " << optarg << std::endl;
+                    return 1;
+                }
+                break;
+            case 'E':
+                if (!parseUploads(optarg, uploads)) {
+                    std::cerr << "Invalid upload policy: " << optarg << std::endl;
+                    return 1;
+                }
+                break;
+            case 'B': binaryLog = true; break;
+            default:
+                std::cerr << "Usage: " << argv[0] << " [-p port] [-s snapshot] [-w warmlist] [-c concurrency] [-T timeouts] [-H hedging] [-L limits] [-E uploads] [-B]" << std::endl;
+                return 1;
+        }
+    }
+
+    try {
+        // Block the signals in every thread, the signal thread below waits for them. This has
+        // to happen before the server starts its own worker threads so they inherit the mask
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGUSR1);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+        // A client hanging up mid-write is an error on that connection, not the end of the proxy
+        signal(SIGPIPE, SIG_IGN);
+
+        // Create the server and listen at the port
+        ProxyServer server(port, timeouts, hedging, maxPerOrigin, maxTotal, uploads, binaryLog);
+        std::thread([&server, signals, snapshotPath]() {
+            while (true) {
+                int sig;
+                if (sigwait(&signals, &sig) != 0) {
+                    continue;
+                }
+                server.logStats();
+                if (!snapshotPath.empty()) {
+                    server.saveSnapshot(snapshotPath);
+                }
+                if (sig != SIGUSR1) {
+                    _exit(0);
+                }
+            }
+        }).detach();
+
+        if (!snapshotPath.empty()) {
+            server.loadSnapshot(snapshotPath);
+        }
+        if (!warmListPath.empty()) {
+            std::ifstream warmList(warmListPath);
+            std::vector<std::string> urls;
+            std::string line;
+            while (std::getline(warmList, line)) {
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                if (!line.empty() && line[0] != '#') {
+                    urls.push_back(line);
+                }
+            }
+            server.warmCache(urls, warmConcurrency);
+        }
         server.start();
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
         return 1;
     }
     return 0;
-} 
\ No newline at end of file
+}
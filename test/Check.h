@@ -0,0 +1,27 @@
+#pragma once
+#include <iostream>
+
+/**
+ * Minimal checks for the unit tests run by ctest. A failed CHECK prints where it failed and
+ * the test carries on; main returns checkResult() so ctest sees any failure.
+ */
+inline int& checkFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+#define CHECK(condition)                                                                    \
+    do {                                                                                    \
+        if (!(condition)) {                                                                 \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            ++checkFailures();                                                              \
+        }                                                                                   \
+    } while (0)
+
+inline int checkResult() {
+    if (checkFailures() > 0) {
+        std::cerr << checkFailures() << " check(s) failed" << std::endl;
+        return 1;
+    }
+    return 0;
+}
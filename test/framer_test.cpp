@@ -0,0 +1,176 @@
+#include "ResponseFramer.h"
+#include "Check.h"
+#include <string>
+
+// Feed data one byte at a time, the way a slow origin would send it. Returns the bytes used
+static size_t feedBytewise(ResponseFramer& framer, const std::string& data) {
+    size_t used = 0;
+    for (size_t i = 0; i < data.size() && !framer.complete() && !framer.error(); ++i) {
+        used += framer.feed(data.data() + i, 1);
+    }
+    return used;
+}
+
+static void testContentLength() {
+    std::string response = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\nCache-Control: max-age=60\r\n\r\nhello";
+    std::string next = "HTTP/1.1 200 OK\r\n";
+    ResponseFramer framer;
+    size_t used = framer.feed(response.data(), 20);
+    CHECK(!framer.headersComplete());
+    used += framer.feed((response + next).data() + 20, response.size() + next.size() - 20);
+    CHECK(framer.complete());
+    CHECK(!framer.error());
+    CHECK(used == response.size());
+    CHECK(framer.mode() == ResponseFramer::CONTENT_LENGTH);
+    CHECK(framer.statusCode() == 200);
+    CHECK(framer.keepAlive());
+    CHECK(framer.maxAge() == 60);
+    CHECK(framer.field(HeaderMap::CONTENT_LENGTH) == "5");
+    CHECK(framer.headLength() == response.size() - 5);
+}
+
+static void testChunkedWithExtensionsAndTrailers() {
+    std::string response = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+                           "5;name=val\r\nhello\r\n"
+                           "7;x=\"q\" \r\n world!\r\n"
+                           "0\r\nX-Trailer: yes\r\nX-Other: no\r\n\r\n";
+    ResponseFramer framer;
+    size_t used = feedBytewise(framer, response + "HTTP/1.1");
+    CHECK(framer.complete());
+    CHECK(!framer.error());
+    CHECK(used == response.size());
+    CHECK(framer.mode() == ResponseFramer::CHUNKED);
+    CHECK(framer.keepAlive());
+
+    ResponseFramer whole;
+    CHECK(whole.feed(response.data(), response.size()) == response.size());
+    CHECK(whole.complete());
+
+    ResponseFramer badSize;
+    std::string bad = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n";
+    badSize.feed(bad.data(), bad.size());
+    CHECK(badSize.error());
+
+    // Chunked that is not the final coding runs until close
+    ResponseFramer notFinal;
+    std::string gzipLast = "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked, gzip\r\n\r\nbody";
+    notFinal.feed(gzipLast.data(), gzipLast.size());
+    CHECK(notFinal.mode() == ResponseFramer::UNTIL_CLOSE);
+    CHECK(!notFinal.keepAlive());
+}
+
+static void testConflictingContentLength() {
+    ResponseFramer repeated;
+    std::string same = "HTTP/1.1 200 OK\r\nContent-Length: 3, 3\r\n\r\nabc";
+    repeated.feed(same.data(), same.size());
+    CHECK(repeated.complete());
+    CHECK(!repeated.error());
+
+    ResponseFramer listed;
+    std::string list = "HTTP/1.1 200 OK\r\nContent-Length: 3, 4\r\n\r\nabcd";
+    listed.feed(list.data(), list.size());
+    CHECK(listed.error());
+
+    ResponseFramer twoLines;
+    std::string lines = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\nContent-Length: 4\r\n\r\nabcd";
+    twoLines.feed(lines.data(), lines.size());
+    CHECK(twoLines.error());
+
+    ResponseFramer negative;
+    std::string minus = "HTTP/1.1 200 OK\r\nContent-Length: -1\r\n\r\n";
+    negative.feed(minus.data(), minus.size());
+    CHECK(negative.error());
+}
+
+static void testInterimResponses() {
+    std::string interim = "HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 103 Early Hints\r\nLink: </a.css>\r\n\r\n";
+    std::string final = "HTTP/1.1 201 Created\r\nContent-Length: 2\r\n\r\nok";
+    ResponseFramer framer;
+    size_t used = feedBytewise(framer, interim + final);
+    CHECK(framer.complete());
+    CHECK(used == interim.size() + final.size());
+    CHECK(framer.statusCode() == 201);
+    CHECK(framer.headLength() == interim.size() + final.size() - 2);
+    CHECK(framer.interimLength() == interim.size());
+    CHECK(framer.statusLine() == "HTTP/1.1 201 Created");
+
+    // A switched protocol ends HTTP on the connection
+    ResponseFramer upgraded;
+    std::string switching = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n\r\n";
+    upgraded.feed(switching.data(), switching.size());
+    CHECK(upgraded.complete());
+    CHECK(!upgraded.keepAlive());
+}
+
+static void testBodilessResponses() {
+    ResponseFramer head(true);
+    std::string headResponse = "HTTP/1.1 200 OK\r\nContent-Length: 1000\r\n\r\n";
+    CHECK(head.feed(headResponse.data(), headResponse.size()) == headResponse.size());
+    CHECK(head.complete());
+    CHECK(head.mode() == ResponseFramer::NO_BODY);
+
+    for (const char* status : {"204 No Content", "304 Not Modified"}) {
+        ResponseFramer framer;
+        std::string response = std::string("HTTP/1.1 ") + status + "\r\nContent-Length: 10\r\n\r\n";
+        CHECK(framer.feed(response.data(), response.size()) == response.size());
+        CHECK(framer.complete());
+        CHECK(framer.mode() == ResponseFramer::NO_BODY);
+        CHECK(framer.keepAlive());
+    }
+}
+
+static void testUntilCloseAndTruncation() {
+    ResponseFramer framer;
+    std::string response = "HTTP/1.0 200 OK\r\n\r\nsome body";
+    CHECK(framer.feed(response.data(), response.size()) == response.size());
+    CHECK(!framer.complete());
+    CHECK(framer.mode() == ResponseFramer::UNTIL_CLOSE);
+    framer.finish();
+    CHECK(framer.complete());
+    CHECK(!framer.keepAlive());
+
+    ResponseFramer truncated;
+    std::string shortBody = "HTTP/1.1 200 OK\r\nContent-Length: 10\r\n\r\nabc";
+    truncated.feed(shortBody.data(), shortBody.size());
+    truncated.finish();
+    CHECK(truncated.error());
+
+    ResponseFramer garbage;
+    std::string notHttp = "SSH-2.0-OpenSSH\r\n\r\n";
+    garbage.feed(notHttp.data(), notHttp.size());
+    CHECK(garbage.error());
+}
+
+static void testRequestFraming() {
+    ResponseFramer bodiless;
+    bodiless.frameRequest("GET / HTTP/1.1\r\nHost: a\r\n\r\n");
+    CHECK(bodiless.complete());
+
+    ResponseFramer withLength;
+    withLength.frameRequest("POST / HTTP/1.1\r\nHost: a\r\nContent-Length: 4\r\n\r\n");
+    CHECK(withLength.mode() == ResponseFramer::CONTENT_LENGTH);
+    CHECK(withLength.bytesRemaining() == 4);
+    CHECK(withLength.feed("abcdGET", 7) == 4);
+    CHECK(withLength.complete());
+
+    ResponseFramer chunked;
+    chunked.frameRequest("POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n");
+    std::string body = "3\r\nabc\r\n0\r\n\r\n";
+    CHECK(chunked.feed(body.data(), body.size()) == body.size());
+    CHECK(chunked.complete());
+
+    ResponseFramer notChunkedLast;
+    notChunkedLast.frameRequest("POST / HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n");
+    CHECK(notChunkedLast.error());
+}
+
+int main() {
+    testContentLength();
+    testChunkedWithExtensionsAndTrailers();
+    testConflictingContentLength();
+    testInterimResponses();
+    testBodilessResponses();
+    testUntilCloseAndTruncation();
+    testRequestFraming();
+    return checkResult();
+}
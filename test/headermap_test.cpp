@@ -0,0 +1,98 @@
+#include "HeaderMap.h"
+#include "Check.h"
+#include <string>
+#include <random>
+#include <algorithm>
+#include <strings.h>
+
+// Every well-known name, in HeaderMap::Id order
+static const char* KNOWN_NAMES[] = {
+    "Accept", "Accept-Encoding", "Accept-Language", "Age", "Authorization", "Cache-Control", "Connection",
+    "Content-Encoding", "Content-Length", "Content-Range", "Content-Type", "Cookie", "Date", "ETag", "Expect",
+    "Expires", "Host", "If-Modified-Since", "If-None-Match", "If-Range", "Keep-Alive", "Last-Modified", "Location",
+    "Pragma", "Proxy-Authorization", "Proxy-Connection", "Range", "Referer", "Set-Cookie", "TE", "Trailer",
+    "Transfer-Encoding", "Upgrade", "User-Agent", "Vary", "Via", "X-Forwarded-For",
+};
+static_assert(sizeof(KNOWN_NAMES) / sizeof(KNOWN_NAMES[0]) == HeaderMap::KNOWN_COUNT, "test names out of step");
+
+static void testKnownNames() {
+    for (int id = 0; id < HeaderMap::KNOWN_COUNT; ++id) {
+        std::string name = KNOWN_NAMES[id];
+        CHECK(HeaderMap::lookup(name) == id);
+        std::string lower = name;
+        std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+        CHECK(HeaderMap::lookup(lower) == id);
+        std::string upper = name;
+        std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+        CHECK(HeaderMap::lookup(upper) == id);
+        // A prefix or an extension of a known name is another header
+        CHECK(HeaderMap::lookup(name.substr(0, name.size() - 1)) == HeaderMap::UNKNOWN);
+        CHECK(HeaderMap::lookup(name + "s") == HeaderMap::UNKNOWN);
+    }
+}
+
+// Random names land in the slots of known names too, the lookup must still tell them apart
+static void testUnknownNames() {
+    CHECK(HeaderMap::lookup("") == HeaderMap::UNKNOWN);
+    CHECK(HeaderMap::lookup("X-Custom") == HeaderMap::UNKNOWN);
+    CHECK(HeaderMap::lookup("Content_Length") == HeaderMap::UNKNOWN);
+    std::mt19937 random(42);
+    const char alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ-";
+    for (int i = 0; i < 100000; ++i) {
+        std::string name(1 + random() % 20, ' ');
+        for (char& c : name) {
+            c = alphabet[random() % (sizeof(alphabet) - 1)];
+        }
+        HeaderMap::Id id = HeaderMap::lookup(name);
+        bool known = false;
+        for (const char* knownName : KNOWN_NAMES) {
+            known = known || strcasecmp(knownName, name.c_str()) == 0;
+        }
+        CHECK(known == (id != HeaderMap::UNKNOWN));
+    }
+}
+
+static void testFields() {
+    HeaderMap headers;
+    CHECK(headers.size() == 0);
+    CHECK(headers.get(HeaderMap::HOST).empty());
+    CHECK(headers.find("X-Custom") == nullptr);
+
+    headers.set("host", "example.com");
+    headers.set("X-Custom", "one");
+    headers.set("x-other", "two");
+    CHECK(headers.has(HeaderMap::HOST));
+    CHECK(headers.has("HOST"));
+    CHECK(headers.get(HeaderMap::HOST) == "example.com");
+    CHECK(headers.find("x-custom") != nullptr && *headers.find("x-custom") == "one");
+    CHECK(headers.size() == 3);
+
+    // A repeated field replaces the earlier one, known or not
+    headers.set("Host", "example.org");
+    headers.set("X-CUSTOM", "three");
+    CHECK(headers.get(HeaderMap::HOST) == "example.org");
+    CHECK(*headers.find("X-Custom") == "three");
+    CHECK(headers.size() == 3);
+
+    // Known fields come first in Id order, names keep the case they arrived in
+    std::string order;
+    headers.set("Accept", "*/*");
+    headers.forEach([&order](HeaderMap::Id id, const HeaderMap::Field& field) {
+        order += std::to_string(id) + ":" + field.name + ";";
+    });
+    CHECK(order == std::to_string(HeaderMap::ACCEPT) + ":Accept;" + std::to_string(HeaderMap::HOST) + ":Host;" +
+                   std::to_string(HeaderMap::UNKNOWN) + ":X-Custom;" + std::to_string(HeaderMap::UNKNOWN) +
+                   ":x-other;");
+
+    CHECK(headers.erase(HeaderMap::HOST));
+    CHECK(!headers.erase(HeaderMap::HOST));
+    CHECK(!headers.has("Host"));
+    CHECK(headers.size() == 3);
+}
+
+int main() {
+    testKnownNames();
+    testUnknownNames();
+    testFields();
+    return checkResult();
+}
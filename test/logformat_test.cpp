@@ -0,0 +1,138 @@
+#include "Logger.h"
+#include "Check.h"
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+#include <sys/wait.h>
+
+/**
+ * Usage: logformat_test path/to/logdump
+ *   Writes the same records to a text log and a binary log, then checks that logdump turns
+ *   the binary one back into the same text lines and into the expected JSON.
+ */
+
+static std::string logdump;
+
+// Run logdump with arguments, returning its stdout and exit status
+static std::string runLogdump(const std::string& arguments, int& status) {
+    std::string output;
+    FILE* pipe = popen((logdump + " " + arguments + " 2>/dev/null").c_str(), "r");
+    if (pipe == nullptr) {
+        status = -1;
+        return output;
+    }
+    char buffer[4096];
+    size_t count;
+    while ((count = fread(buffer, 1, sizeof(buffer), pipe)) > 0) {
+        output.append(buffer, count);
+    }
+    int result = pclose(pipe);
+    status = WIFEXITED(result) ? WEXITSTATUS(result) : -1;
+    return output;
+}
+
+// Lines of text without the " YYYY-MM-DD HH:MM:SS" each log line ends with
+static std::vector<std::string> untimedLines(const std::string& text) {
+    std::vector<std::string> lines;
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line)) {
+        lines.push_back(line.size() >= 20 ? line.substr(0, line.size() - 20) : line);
+    }
+    return lines;
+}
+
+static std::string readFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream content;
+    content << in.rdbuf();
+    return content.str();
+}
+
+static void writeRecords(Logger& logger) {
+    logger.log(Logger::INFO, "plain message");
+    logger.log("client message", 3);
+    // Repeated short fields are interned from their second appearance on
+    for (int i = 0; i < 3; ++i) {
+        logger.event(EVENT_CONNECTION, 7, "10.0.0.1");
+    }
+    logger.event(EVENT_REQUEST, 7, "GET http://a/ HTTP/1.1", "a");
+    logger.log(Logger::WARNING, std::string(300, 'x'));
+    logger.log(Logger::ERROR, "quote \" and backslash \\ and tab \t");
+    RequestTrace trace;
+    trace.status = 200;
+    trace.bytesIn = 120;
+    trace.bytesOut = 3456;
+    trace.cache = CACHE_MISS;
+    trace.upstreamReused = true;
+    trace.parseMicros = 5;
+    trace.ttfbMicros = 700;
+    trace.transferMicros = 800;
+    logger.access(7, "GET", "http://a/", trace);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " path/to/logdump" << std::endl;
+        return 1;
+    }
+    logdump = argv[1];
+    char directory[] = "/tmp/logformat_testXXXXXX";
+    if (mkdtemp(directory) == nullptr) {
+        std::cerr << "cannot create a temporary directory" << std::endl;
+        return 1;
+    }
+    std::string textPath = std::string(directory) + "/proxy.log";
+    std::string binaryPath = std::string(directory) + "/proxy.bin";
+    std::string truncatedPath = std::string(directory) + "/truncated.bin";
+    {
+        // The destructors drain the rings into the files
+        Logger text(textPath, Logger::TEXT);
+        Logger binary(binaryPath, Logger::BINARY);
+        writeRecords(text);
+        writeRecords(binary);
+    }
+
+    int status = 0;
+    std::vector<std::string> expected = untimedLines(readFile(textPath));
+    std::vector<std::string> decoded = untimedLines(runLogdump(binaryPath, status));
+    CHECK(status == 0);
+    CHECK(expected.size() == 9);
+    CHECK(decoded == expected);
+    CHECK(expected.back() == "7: GET http://a/ 200 MISS in=120 out=3456 reused=1 parse=5us dns=0us connect=0us "
+                             "ttfb=700us transfer=800us");
+
+    std::string json = runLogdump("-f json " + binaryPath, status);
+    CHECK(status == 0);
+    CHECK(json.find("\"event\":\"connection\",\"level\":\"INFO\",\"client\":7,\"address\":\"10.0.0.1\"") !=
+          std::string::npos);
+    CHECK(json.find("\"message\":\"quote \\\" and backslash \\\\ and tab \\u0009\"") != std::string::npos);
+    CHECK(json.find("\"method\":\"GET\",\"url\":\"http://a/\",\"cache\":\"MISS\",\"status\":200,\"bytes_in\":120,"
+                    "\"bytes_out\":3456,\"reused\":1") != std::string::npos);
+
+    std::string csv = runLogdump("-f csv " + binaryPath, status);
+    CHECK(status == 0);
+    CHECK(csv.find(",access,INFO,7,\"GET\",\"http://a/\",\"MISS\",200,120,3456,1,5,0,0,700,800,\n") !=
+          std::string::npos);
+
+    // A cut-off record is reported, the ones before it are still decoded
+    std::string bytes = readFile(binaryPath);
+    std::ofstream(truncatedPath, std::ios::binary) << bytes.substr(0, bytes.size() - 3);
+    std::vector<std::string> partial = untimedLines(runLogdump(truncatedPath, status));
+    CHECK(status != 0);
+    CHECK(partial.size() == expected.size() - 1);
+
+    // The text log is not a binary log
+    runLogdump(textPath, status);
+    CHECK(status != 0);
+
+    unlink(textPath.c_str());
+    unlink(binaryPath.c_str());
+    unlink(truncatedPath.c_str());
+    rmdir(directory);
+    return checkResult();
+}
@@ -0,0 +1,270 @@
+#include "LogEvents.h"
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <unistd.h>
+
+/**
+ * Usage: logdump [-f text|json|csv] file...
+ *   Converts binary proxy logs (proxy_server -B) to the text log lines, to JSON with one
+ *   object per line, or to CSV with the string fields and then the numbers in order
+ */
+
+enum OutputFormat { TEXT, JSON, CSV };
+
+// Buffered sequential reader over a log file
+class RecordReader {
+private:
+    FILE* file;
+    std::vector<char> buffer;
+    size_t start;
+    size_t end;
+
+public:
+    explicit RecordReader(FILE* file) : file(file), buffer(1 << 20), start(0), end(0) {}
+
+    // Make length bytes available at data(), false at the end of the file
+    bool need(size_t length) {
+        if (end - start >= length) {
+            return true;
+        }
+        memmove(buffer.data(), buffer.data() + start, end - start);
+        end -= start;
+        start = 0;
+        if (buffer.size() < length) {
+            buffer.resize(length);
+        }
+        while (end < length) {
+            size_t count = fread(buffer.data() + end, 1, buffer.size() - end, file);
+            if (count == 0) {
+                return false;
+            }
+            end += count;
+        }
+        return true;
+    }
+    const char* data() const { return buffer.data() + start; }
+    void skip(size_t length) { start += length; }
+};
+
+static uint64_t readLittleEndian(const char* data, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i) {
+        value |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (8 * i);
+    }
+    return value;
+}
+
+static bool readVarint(const char*& data, const char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; data < end && shift < 64; shift += 7) {
+        unsigned char byte = static_cast<unsigned char>(*data++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void appendJsonString(std::string& out, std::string_view value) {
+    out += '"';
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+static void appendCsvField(std::string& out, std::string_view value) {
+    out += '"';
+    for (char c : value) {
+        if (c == '"') {
+            out += '"';
+        }
+        out += c;
+    }
+    out += '"';
+}
+
+static void appendRecord(std::string& out, OutputFormat format, uint8_t type, uint8_t level, int clientId,
+                         int64_t time, const std::string_view* fields, size_t fieldCount, const uint64_t* numbers,
+                         size_t numberCount) {
+    const LogEventInfo* info = logEventInfo(type);
+    if (format == TEXT) {
+        time_t seconds = static_cast<time_t>(time / 1000000);
+        struct tm tm;
+        localtime_r(&seconds, &tm);
+        char timeText[32];
+        strftime(timeText, sizeof(timeText), "%Y-%m-%d %H:%M:%S", &tm);
+        renderLogLine(out, type, level, clientId, fields, fieldCount, numbers, numberCount, timeText);
+    } else if (format == JSON) {
+        out += "{\"time_us\":" + std::to_string(time) + ",\"event\":";
+        appendJsonString(out, info ? info->name : "unknown");
+        out += ",\"level\":";
+        appendJsonString(out, logLevelName(level));
+        if (clientId != LOG_NO_CLIENT) {
+            out += ",\"client\":" + std::to_string(clientId);
+        }
+        for (size_t i = 0; i < fieldCount; ++i) {
+            out += ',';
+            appendJsonString(out, info && i < info->fieldCount ? info->fieldNames[i] : "field" + std::to_string(i));
+            out += ':';
+            appendJsonString(out, fields[i]);
+        }
+        for (size_t i = 0; i < numberCount; ++i) {
+            out += ',';
+            appendJsonString(out, info->fieldNames[info->fieldCount + i]);
+            out += ':' + std::to_string(numbers[i]);
+        }
+        out += "}\n";
+    } else {
+        out += std::to_string(time) + ',' + (info ? info->name : "unknown") + ',' + logLevelName(level) + ',';
+        if (clientId != LOG_NO_CLIENT) {
+            out += std::to_string(clientId);
+        }
+        for (size_t i = 0; i < LOG_MAX_FIELDS; ++i) {
+            out += ',';
+            if (i < fieldCount) {
+                appendCsvField(out, fields[i]);
+            }
+        }
+        for (size_t i = 0; i < LOG_MAX_NUMBERS; ++i) {
+            out += ',';
+            if (i < numberCount) {
+                out += std::to_string(numbers[i]);
+            }
+        }
+        out += '\n';
+    }
+}
+
+/**
+ * @brief: Convert one binary log to format on stdout. Returns false when the file is not
+ *         a binary log or ends in the middle of a record.
+ */
+static bool dump(const char* path, OutputFormat format) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        std::cerr << "logdump: cannot open " << path << ": " << strerror(errno) << std::endl;
+        return false;
+    }
+    RecordReader reader(file);
+    if (!reader.need(LOG_MAGIC_SIZE) || memcmp(reader.data(), LOG_MAGIC, LOG_MAGIC_SIZE) != 0) {
+        std::cerr << "logdump: " << path << " is not a binary proxy log" << std::endl;
+        fclose(file);
+        return false;
+    }
+    reader.skip(LOG_MAGIC_SIZE);
+
+    std::vector<std::string> strings;
+    std::string out;
+    bool intact = true;
+    while (reader.need(LOG_HEADER_SIZE)) {
+        const char* header = reader.data();
+        uint8_t type = static_cast<uint8_t>(header[0]);
+        uint8_t level = static_cast<uint8_t>(header[1]);
+        size_t length = readLittleEndian(header + 2, 2);
+        int clientId = static_cast<int32_t>(readLittleEndian(header + 4, 4));
+        int64_t time = static_cast<int64_t>(readLittleEndian(header + 8, 8));
+        if (!reader.need(LOG_HEADER_SIZE + length)) {
+            intact = false;
+            break;
+        }
+        const char* payload = reader.data() + LOG_HEADER_SIZE;
+        const char* payloadEnd = payload + length;
+        uint64_t value = 0;
+        if (type == LOG_STRING_DEFINITION) {
+            if (!readVarint(payload, payloadEnd, value) || value > UINT32_MAX) {
+                intact = false;
+                break;
+            }
+            if (value >= strings.size()) {
+                strings.resize(value + 1);
+            }
+            strings[value].assign(payload, payloadEnd);
+        } else if (logEventInfo(type) != nullptr) {
+            // The event table tells how many of the varints start string fields
+            const LogEventInfo* info = logEventInfo(type);
+            std::string_view fields[LOG_MAX_FIELDS];
+            size_t fieldCount = 0;
+            while (payload < payloadEnd && fieldCount < info->fieldCount && readVarint(payload, payloadEnd, value)) {
+                if (value & 1) {
+                    fields[fieldCount++] = (value >> 1) < strings.size() ? std::string_view(strings[value >> 1])
+                                                                        : std::string_view("?");
+                } else if ((value >> 1) <= static_cast<uint64_t>(payloadEnd - payload)) {
+                    fields[fieldCount++] = std::string_view(payload, value >> 1);
+                    payload += value >> 1;
+                } else {
+                    break;
+                }
+            }
+            uint64_t numbers[LOG_MAX_NUMBERS];
+            size_t numberCount = 0;
+            while (payload < payloadEnd && numberCount < info->numberCount &&
+                   readVarint(payload, payloadEnd, numbers[numberCount])) {
+                ++numberCount;
+            }
+            appendRecord(out, format, type, level, clientId, time, fields, fieldCount, numbers, numberCount);
+            if (out.size() >= (1 << 16)) {
+                fwrite(out.data(), 1, out.size(), stdout);
+                out.clear();
+            }
+        }
+        // Records of event types newer than this build are skipped
+        reader.skip(LOG_HEADER_SIZE + length);
+    }
+    fwrite(out.data(), 1, out.size(), stdout);
+    fclose(file);
+    if (!intact) {
+        std::cerr << "logdump: " << path << " ends with a truncated record" << std::endl;
+    }
+    return intact;
+}
+
+int main(int argc, char* argv[]) {
+    OutputFormat format = TEXT;
+    int opt;
+    while ((opt = getopt(argc, argv, "f:")) != -1) {
+        std::string value = optarg ? optarg : "";
+        if (opt == 'f' && value == "text") {
+            format = TEXT;
+        } else if (opt == 'f' && value == "json") {
+            format = JSON;
+        } else if (opt == 'f' && value == "csv") {
+            format = CSV;
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [-f text|json|csv] file..." << std::endl;
+            return 1;
+        }
+    }
+    if (optind == argc) {
+        std::cerr << "Usage: " << argv[0] << " [-f text|json|csv] file..." << std::endl;
+        return 1;
+    }
+    if (format == CSV) {
+        fputs("time_us,event,level,client,field1,field2,field3", stdout);
+        for (int i = 1; i <= LOG_MAX_NUMBERS; ++i) {
+            printf(",number%d", i);
+        }
+        fputs("\n", stdout);
+    }
+    bool ok = true;
+    for (int i = optind; i < argc; ++i) {
+        ok = dump(argv[i], format) && ok;
+    }
+    return ok ? 0 : 1;
+}